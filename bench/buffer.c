@@ -0,0 +1,287 @@
+// Cost of the editing core in buffer.h, built and run without a window
+//
+//     make bench
+//     make bench BENCH_MAX_SIZE=67108864
+//
+// Synthetic files from 1 KB up to BENCH_MAX_SIZE (1 GB by default) are
+// loaded and saved, and every edit and motion is run from the start, the
+// middle and the end of them. Each size runs in its own process so the peak
+// RSS it reports is its own. One line per case on stdout:
+//
+//     size=1048576 case=insert pos=50 ops=100000 ns_per_op=41.2 allocs_per_op=0.001 peak_rss_kb=5120
+//
+// Allocations are the malloc, calloc and realloc calls made by buffer.h,
+// including the ones made on its threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+atomic_size_t bench_allocs;
+
+void *bench_malloc(size_t size)
+{
+    atomic_fetch_add(&bench_allocs, 1);
+    return malloc(size);
+}
+
+void *bench_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add(&bench_allocs, 1);
+    return calloc(count, size);
+}
+
+void *bench_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&bench_allocs, 1);
+    return realloc(ptr, size);
+}
+
+// Only what buffer.h allocates gets counted, the headers it includes have
+// already been seen with the real names
+#define malloc(size) bench_malloc(size)
+#define calloc(count, size) bench_calloc(count, size)
+#define realloc(ptr, size) bench_realloc(ptr, size)
+#include "../buffer.h"
+#undef malloc
+#undef calloc
+#undef realloc
+
+#define BENCH_MIN_SIZE 1024
+#define BENCH_DEFAULT_MAX_SIZE (1024*1024*1024)
+#define BENCH_OPS 100000
+#define BENCH_BLOCK (1024*1024)
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+long peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+typedef struct {
+    size_t size;
+    const char *name;
+    int pos; // Percent of the way through the text, -1 when it doesn't apply
+    size_t ops;
+    double start_ns;
+    size_t start_allocs;
+} Case;
+
+Case case_begin(size_t size, const char *name, int pos, size_t ops)
+{
+    Case c = {size, name, pos, ops, 0, 0};
+    c.start_allocs = atomic_load(&bench_allocs);
+    c.start_ns = now_ns();
+    return c;
+}
+
+void case_end(Case c)
+{
+    double ns = now_ns() - c.start_ns;
+    size_t allocs = atomic_load(&bench_allocs) - c.start_allocs;
+
+    printf(
+        "size=%zu case=%s pos=%d ops=%zu ns_per_op=%.1f allocs_per_op=%.3f peak_rss_kb=%ld\n",
+        c.size, c.name, c.pos, c.ops, ns / c.ops, (double)allocs / c.ops, peak_rss_kb()
+    );
+    fflush(stdout);
+}
+
+// Lines of code-like length, mostly ASCII with the odd two byte codepoint.
+// One block is generated and written over and over.
+int make_file(const char *path, size_t size)
+{
+    char *block = malloc(BENCH_BLOCK);
+    srand(1);
+
+    size_t line_left = rand() % 80;
+
+    for (size_t i = 0; i < BENCH_BLOCK; i++)
+    {
+        if (line_left-- == 0)
+        {
+            block[i] = '\n';
+            line_left = rand() % 80;
+        }
+        else if (rand() % 50 == 0 && i + 1 < BENCH_BLOCK)
+        {
+            block[i++] = (char)0xC3;
+            block[i] = (char)0xA9;
+        }
+        else
+        {
+            block[i] = 32 + rand() % 95;
+        }
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        free(block);
+        return -1;
+    }
+
+    for (size_t written = 0; written < size;)
+    {
+        size_t n = size - written < BENCH_BLOCK ? size - written : BENCH_BLOCK;
+        fwrite(block, 1, n, f);
+        written += n;
+    }
+
+    free(block);
+    return fclose(f);
+}
+
+void load(Buffer *b, const char *path)
+{
+    if (buffer_load_from_file(b, path) < 0)
+    {
+        fprintf(stderr, "[ERROR] Couldn't read '%s'\n", path);
+        exit(1);
+    }
+    while (!buffer_poll_loading(b)) usleep(50);
+}
+
+typedef void (*Motion)(Buffer *b);
+
+typedef struct {
+    const char *name;
+    Motion fn;
+} MotionCase;
+
+const MotionCase motions[] = {
+    {"move_right", buffer_move_right},
+    {"move_left", buffer_move_left},
+    {"move_down", buffer_move_down},
+    {"move_up", buffer_move_up},
+    {"move_line_begin", buffer_move_line_begin},
+    {"move_line_end", buffer_move_line_end},
+    {"move_next_word", buffer_move_next_word},
+    {"move_prev_word", buffer_move_prev_word},
+};
+
+void bench_size(const char *dir, size_t size)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%zu.txt", dir, size);
+
+    if (make_file(path, size) < 0)
+    {
+        fprintf(stderr, "[ERROR] Failed to write '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    Buffer b = {0};
+    int loads = size > 64*1024*1024 ? 1 : 5;
+
+    Case c = case_begin(size, "load", -1, loads);
+    for (int i = 0; i < loads; i++)
+    {
+        load(&b, path);
+        if (i + 1 < loads) buffer_unload(&b);
+    }
+    case_end(c);
+
+    int positions[] = {0, 50, 100};
+
+    for (size_t p = 0; p < sizeof(positions) / sizeof(*positions); p++)
+    {
+        size_t pos = (size_t)((double)b.text.len * positions[p] / 100);
+
+        // Inserted text is deleted again, so the text is the same size for
+        // every case
+        b.index = pos;
+        c = case_begin(size, "insert", positions[p], BENCH_OPS);
+        for (size_t i = 0; i < BENCH_OPS; i++) buffer_insert(&b, 'a' + i % 26);
+        case_end(c);
+
+        c = case_begin(size, "delete", positions[p], BENCH_OPS);
+        for (size_t i = 0; i < BENCH_OPS; i++) buffer_delete(&b);
+        case_end(c);
+
+        for (size_t m = 0; m < sizeof(motions) / sizeof(*motions); m++)
+        {
+            b.index = pos;
+            c = case_begin(size, motions[m].name, positions[p], BENCH_OPS);
+            for (size_t i = 0; i < BENCH_OPS; i++) motions[m].fn(&b);
+            case_end(c);
+        }
+
+        // Keep the compiler from dropping the calls
+        volatile size_t sink = 0;
+
+        b.index = pos;
+        c = case_begin(size, "get_row", positions[p], BENCH_OPS);
+        for (size_t i = 0; i < BENCH_OPS; i++) sink += buffer_get_row(b);
+        case_end(c);
+
+        c = case_begin(size, "get_col", positions[p], BENCH_OPS);
+        for (size_t i = 0; i < BENCH_OPS; i++) sink += buffer_get_col(b);
+        case_end(c);
+
+        (void)sink;
+    }
+
+    SaveJob job;
+    save_job_init(&job);
+    int saves = size > 64*1024*1024 ? 1 : 5;
+
+    c = case_begin(size, "save", -1, saves);
+    for (int i = 0; i < saves; i++)
+    {
+        if (save_job_start(&job, &b.text, path) < 0 || save_job_poll(&job, 1) != SAVE_DONE)
+        {
+            fprintf(stderr, "[ERROR] %s\n", job.error);
+            exit(1);
+        }
+    }
+    case_end(c);
+
+    buffer_clear(&b);
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    size_t max_size = argc > 1 ? strtoull(argv[1], NULL, 0) : BENCH_DEFAULT_MAX_SIZE;
+
+    char dir[] = "/tmp/codigo-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "[ERROR] Failed to create a directory for the files: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int failed = 0;
+
+    for (size_t size = BENCH_MIN_SIZE; size <= max_size; size *= 32)
+    {
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            bench_size(dir, size);
+            exit(0);
+        }
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+
+    rmdir(dir);
+    return failed;
+}
@@ -0,0 +1,119 @@
+// Microbenchmark for GetGlyphIndex against the linear scan it replaced
+//
+//     make bench_glyphs
+//
+// Fonts are synthetic, only the codepoints of their glyphs matter for the
+// lookup, so no window or font file is needed.
+
+#include <raylib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUP_COUNT (1000*1000*10)
+#define SAMPLE_COUNT 4096
+
+// GetGlyphIndex before the lookup table
+int glyph_index_linear(Font font, int codepoint)
+{
+    int index = 0;
+    int fallback_index = 0;
+
+    for (int i = 0; i < font.glyphCount; i++)
+    {
+        if (font.glyphs[i].value == 63) fallback_index = i;
+
+        if (font.glyphs[i].value == codepoint)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if ((index == 0) && (font.glyphs[0].value != codepoint)) index = fallback_index;
+
+    return index;
+}
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ASCII first, then whatever comes next in the BMP, plus some emoji so both
+// sides of the lookup table get exercised on large fonts
+Font make_font(int glyph_count)
+{
+    Font font = {0};
+    font.glyphCount = glyph_count;
+    font.glyphs = calloc(glyph_count, sizeof(*font.glyphs));
+
+    for (int i = 0; i < glyph_count; i++)
+    {
+        if (i < 95) font.glyphs[i].value = 32 + i;
+        else if (i % 10 == 0) font.glyphs[i].value = 0x1F300 + i;
+        else font.glyphs[i].value = 0x00A0 + i;
+    }
+
+    return font;
+}
+
+// Mostly ASCII like a source file, with a tail of codepoints from the rest of
+// the font and a few the font doesn't have
+void make_samples(Font font, int *samples)
+{
+    srand(1);
+
+    for (int i = 0; i < SAMPLE_COUNT; i++)
+    {
+        int r = rand() % 100;
+
+        if (r < 90) samples[i] = 32 + rand() % 95;
+        else if (r < 98) samples[i] = font.glyphs[rand() % font.glyphCount].value;
+        else samples[i] = 0x4E00 + rand() % 100;
+    }
+}
+
+void bench_font(int glyph_count)
+{
+    Font font = make_font(glyph_count);
+
+    int samples[SAMPLE_COUNT];
+    make_samples(font, samples);
+
+    for (int i = 0; i < SAMPLE_COUNT; i++)
+    {
+        if (GetGlyphIndex(font, samples[i]) != glyph_index_linear(font, samples[i]))
+        {
+            fprintf(stderr, "[ERROR] Lookup mismatch for codepoint %d\n", samples[i]);
+            exit(1);
+        }
+    }
+
+    long checksum = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < LOOKUP_COUNT; i++) checksum += glyph_index_linear(font, samples[i % SAMPLE_COUNT]);
+    double linear_ns = (now_ns() - start) / LOOKUP_COUNT;
+
+    start = now_ns();
+    for (int i = 0; i < LOOKUP_COUNT; i++) checksum -= GetGlyphIndex(font, samples[i % SAMPLE_COUNT]);
+    double table_ns = (now_ns() - start) / LOOKUP_COUNT;
+
+    printf("glyphs=%d linear=%.2fns/op table=%.2fns/op speedup=%.1fx checksum=%ld\n",
+        glyph_count, linear_ns, table_ns, linear_ns / table_ns, checksum);
+
+    UnloadFontData(font.glyphs, font.glyphCount);
+}
+
+int main(void)
+{
+    SetTraceLogLevel(LOG_WARNING);
+
+    bench_font(250);
+    bench_font(5000);
+
+    return 0;
+}
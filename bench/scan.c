@@ -0,0 +1,146 @@
+// Throughput of the text scanning kernels in scan.h
+//
+//     make bench_scan
+//
+// Built without auto-vectorization so the scalar kernels are the byte at a
+// time loops they replaced. Walking every line with next/prev newline is what
+// loading a file and moving around it do, so those are measured that way.
+
+#include "../scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TEXT_LEN (64*1024*1024)
+#define REPEAT 8
+#define DECODE_ROW 256
+
+double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Lines of code-like length, mostly ASCII with the odd two byte codepoint
+char *make_text(size_t len)
+{
+    char *text = malloc(len);
+    srand(1);
+
+    size_t line_left = rand() % 80;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (line_left-- == 0)
+        {
+            text[i] = '\n';
+            line_left = rand() % 80;
+        }
+        else if (rand() % 50 == 0 && i + 1 < len)
+        {
+            text[i++] = (char)0xC3;
+            text[i] = (char)0xA9;
+        }
+        else
+        {
+            text[i] = 32 + rand() % 95;
+        }
+    }
+
+    return text;
+}
+
+size_t walk_next(const ScanImpl *impl, const char *text, size_t len)
+{
+    size_t lines = 0;
+
+    for (size_t i = impl->next_newline(text, len); i < len; i += 1 + impl->next_newline(text + i + 1, len - i - 1))
+        lines += 1;
+
+    return lines;
+}
+
+// Decodes the text a screen row at a time, like the render loop does
+size_t decode_rows(const char *text, size_t len)
+{
+    static int codepoints[DECODE_ROW];
+    size_t decoded = 0;
+
+    for (size_t i = 0; i < len; i += DECODE_ROW)
+    {
+        size_t row_len = len - i < DECODE_ROW ? len - i : DECODE_ROW;
+        decoded += scan_decode_utf8(text + i, row_len, codepoints, DECODE_ROW);
+    }
+
+    return decoded;
+}
+
+size_t walk_prev(const ScanImpl *impl, const char *text, size_t len)
+{
+    size_t lines = 0;
+
+    for (size_t i = impl->prev_newline(text, len); i != SIZE_MAX; i = impl->prev_newline(text, i))
+        lines += 1;
+
+    return lines;
+}
+
+void bench_impl(const ScanImpl *impl, const char *text, size_t len)
+{
+    size_t results[5] = {0};
+    double ns[5] = {0};
+
+    // The decoder goes through scan_get, point it at the kernels measured
+    scan_impl = impl;
+
+    for (int r = 0; r < REPEAT; r++)
+    {
+        double start = now_ns();
+        results[0] = impl->count_newlines(text, len);
+        ns[0] += now_ns() - start;
+
+        start = now_ns();
+        results[1] = impl->count_codepoints(text, len);
+        ns[1] += now_ns() - start;
+
+        start = now_ns();
+        results[2] = walk_next(impl, text, len);
+        ns[2] += now_ns() - start;
+
+        start = now_ns();
+        results[3] = walk_prev(impl, text, len);
+        ns[3] += now_ns() - start;
+
+        start = now_ns();
+        results[4] = decode_rows(text, len);
+        ns[4] += now_ns() - start;
+    }
+
+    const char *names[5] = {"count_newlines", "count_codepoints", "next_newline", "prev_newline", "decode_utf8"};
+
+    for (int k = 0; k < 5; k++)
+    {
+        printf("impl=%s kernel=%s gbps=%.2f result=%zu\n",
+            impl->name, names[k], (double)len * REPEAT / ns[k], results[k]);
+    }
+}
+
+int main(void)
+{
+    char *text = make_text(TEXT_LEN);
+
+    bench_impl(&scan_scalar, text, TEXT_LEN);
+
+#ifdef SCAN_X86
+    bench_impl(&scan_sse2, text, TEXT_LEN);
+    if (__builtin_cpu_supports("avx2")) bench_impl(&scan_avx2, text, TEXT_LEN);
+#endif
+
+    scan_impl = NULL;
+    printf("selected=%s\n", scan_get()->name);
+
+    free(text);
+    return 0;
+}
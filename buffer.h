@@ -0,0 +1,3178 @@
+// Buffer core: the piece table holding the text, the loader and the save
+// job that move it between files and memory, the syntax state of each row and
+// the buffer with its motions. Nothing in here draws or reads input, so it
+// builds without a display for the benchmarks:
+//
+//     make bench
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <raylib.h> // Only for Vector2, nothing from the library is called
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "scan.h"
+#include "syntax.h"
+
+#define STRING_INIT_CAP (1024*4)
+#define EDIT_LOG_CAP 64
+
+typedef struct {
+    char  *data;
+    size_t len;
+    size_t cap;
+} String;
+
+void string_check_capacity(String *s)
+{
+    if (s->len >= s->cap)
+    {
+        if (s->cap == 0) s->cap = STRING_INIT_CAP;
+
+        while (s->len >= s->cap) s->cap *= 2;
+
+        void *buf = realloc(s->data, s->cap * sizeof(*s->data));
+        assert(buf != NULL && "Failed to realloc string");
+
+        s->data = (char*)buf;
+    }
+}
+
+// Only the terminator is written, not the whole capacity
+void string_init(String *s)
+{
+    string_check_capacity(s);
+    s->data[0] = '\0';
+    s->len = 0;
+}
+
+void string_clear(String *s)
+{
+    if (s->data != NULL) s->data[0] = '\0';
+    s->len = 0;
+}
+
+// Gives memory back once at most a quarter of the capacity is in use, down to
+// the smallest power of two past the length
+void string_shrink(String *s)
+{
+    if (s->cap <= STRING_INIT_CAP || s->len >= s->cap / 4) return;
+
+    size_t cap = STRING_INIT_CAP;
+    while (s->len >= cap) cap *= 2;
+
+    void *buf = realloc(s->data, cap * sizeof(*s->data));
+    assert(buf != NULL && "Failed to realloc string");
+
+    s->data = (char*)buf;
+    s->cap = cap;
+}
+
+void string_append(String *s, const char *data, size_t len)
+{
+    size_t old_len = s->len;
+
+    s->len += len;
+    string_check_capacity(s);
+
+    memcpy(s->data + old_len, data, len);
+    s->data[s->len] = '\0';
+}
+
+// Bytes something holds: `used` by what is in it and `reserved` from the
+// allocator, what is reserved and not used is wasted
+typedef struct {
+    size_t used;
+    size_t reserved;
+} MemoryUsage;
+
+void memory_usage_add(MemoryUsage *m, size_t used, size_t reserved)
+{
+    m->used += used;
+    m->reserved += reserved;
+}
+
+void string_info(String *s)
+{
+    printf("len = %lu\n", s->len);
+    printf("cap = %lu\n", s->cap);
+}
+
+// File map: a read-only view of a file's contents straight from the page
+// cache. Opening costs the same whatever the size of the file and pages are
+// only read in when something looks at them.
+typedef struct {
+    const char *data;
+    size_t len;
+} FileMap;
+
+int file_map_open(FileMap *m, const char *file_path)
+{
+    *m = (FileMap){0};
+
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        // Callers tell a missing file, which is a new one, from the rest
+        int err = errno;
+        fprintf(stderr, "[ERROR] Tried to open '%s': %s\n", file_path, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "[ERROR] Tried to obtain size of '%s': %s\n", file_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Empty files can't be mapped, there is nothing to map anyway
+    if (st.st_size > 0)
+    {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "[ERROR] Tried to map '%s': %s\n", file_path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        m->data = data;
+        m->len = (size_t)st.st_size;
+    }
+
+    // The mapping holds its own reference to the file
+    close(fd);
+
+    return 1;
+}
+
+void file_map_close(FileMap *m)
+{
+    if (m->len > 0) munmap((void*)m->data, m->len);
+    *m = (FileMap){0};
+}
+
+typedef struct {
+    size_t *data;
+    size_t  len;
+    size_t  cap;
+} Offsets;
+
+void offsets_push(Offsets *o, size_t offset)
+{
+    if (o->len >= o->cap)
+    {
+        o->cap = o->cap == 0 ? 256 : o->cap * 2;
+
+        void *buf = realloc(o->data, o->cap * sizeof(*o->data));
+        assert(buf != NULL && "Failed to realloc offsets");
+
+        o->data = (size_t*)buf;
+    }
+
+    o->data[o->len++] = offset;
+}
+
+// Index of the first offset that is not below `offset`
+size_t offsets_lower_bound(const Offsets *o, size_t offset)
+{
+    size_t lo = 0, hi = o->len;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (o->data[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+void offsets_push_newlines(Offsets *o, const char *data, size_t base, size_t len)
+{
+    for (size_t i = scan_next_newline(data, len); i < len; i += 1 + scan_next_newline(data + i + 1, len - i - 1))
+    {
+        offsets_push(o, base + i);
+    }
+}
+
+// Piece table: the text is the in-order concatenation of pieces, each one a
+// slice of either the original file contents or the append-only `added`
+// buffer. Pieces live in a treap ordered by position, so every edit costs
+// O(log pieces) plus the bytes inserted, whatever the size of the file.
+//
+// Each source also records where its newlines are, which lets every piece
+// know its line count in O(log n) and the treap answer row queries without
+// looking at the text.
+
+typedef struct {
+    size_t first;
+    size_t last;
+} RowRange;
+
+// Bytes [start, start+len) of a text
+typedef struct {
+    size_t start;
+    size_t len;
+} Match;
+
+typedef enum {
+    PIECE_ORIGINAL = 0,
+    PIECE_ADDED,
+} PieceSource;
+
+typedef struct PieceNode PieceNode;
+
+struct PieceNode {
+    PieceNode  *left;
+    PieceNode  *right;
+    unsigned    priority;
+    PieceSource source;
+    size_t      start;
+    size_t      len;
+    size_t      lf;
+    size_t      total;    // Bytes in this subtree
+    size_t      lf_total; // Newlines in this subtree
+    size_t      count;    // Pieces in this subtree
+};
+
+// Pieces are handed out of slabs of PIECE_SLAB_CAP and freed ones are kept for
+// the next, instead of a malloc and a free for each
+#define PIECE_SLAB_CAP 1024
+
+typedef struct PieceSlab PieceSlab;
+
+struct PieceSlab {
+    PieceSlab *next;
+    PieceNode  nodes[PIECE_SLAB_CAP];
+};
+
+typedef struct {
+    FileMap    original;
+    String     added;
+    Offsets    original_lines;
+    Offsets    added_lines;
+    PieceNode *root;
+    size_t     len;
+    unsigned   seed;
+
+    // Newest slab first, `slab_used` of its pieces handed out. Freed pieces
+    // are chained through `left`.
+    PieceSlab *slabs;
+    size_t     slabs_len;
+    size_t     slab_used;
+    PieceNode *free_pieces;
+    size_t     free_pieces_len;
+
+    // Last piece looked up, makes sequential access O(1)
+    const char *span;
+    size_t      span_begin;
+    size_t      span_len;
+
+    // Rows touched by the last EDIT_LOG_CAP edits, so whoever caches
+    // something per row knows what to redo
+    RowRange    edit_log[EDIT_LOG_CAP];
+    size_t      edit_count;
+
+    // While pinned, memory that spans may point into is retired instead of
+    // being moved or freed, so a snapshot of the spans stays readable from
+    // another thread
+    int         pins;
+    FileMap    *retired;
+    size_t      retired_len;
+    size_t      retired_cap;
+} PieceTable;
+
+size_t piece_node_total(PieceNode *n)
+{
+    return n != NULL ? n->total : 0;
+}
+
+size_t piece_node_lf_total(PieceNode *n)
+{
+    return n != NULL ? n->lf_total : 0;
+}
+
+size_t piece_node_count(PieceNode *n)
+{
+    return n != NULL ? n->count : 0;
+}
+
+void piece_node_update(PieceNode *n)
+{
+    n->total    = piece_node_total(n->left) + n->len + piece_node_total(n->right);
+    n->lf_total = piece_node_lf_total(n->left) + n->lf + piece_node_lf_total(n->right);
+    n->count    = piece_node_count(n->left) + 1 + piece_node_count(n->right);
+}
+
+Offsets *piece_source_lines(PieceTable *pt, PieceSource source)
+{
+    return source == PIECE_ORIGINAL ? &pt->original_lines : &pt->added_lines;
+}
+
+// Newlines in [start, start+len) of a source
+size_t piece_source_lf(PieceTable *pt, PieceSource source, size_t start, size_t len)
+{
+    Offsets *lines = piece_source_lines(pt, source);
+    return offsets_lower_bound(lines, start + len) - offsets_lower_bound(lines, start);
+}
+
+PieceNode *piece_node_alloc(PieceTable *pt)
+{
+    PieceNode *n = pt->free_pieces;
+
+    if (n != NULL)
+    {
+        pt->free_pieces = n->left;
+        pt->free_pieces_len -= 1;
+    }
+    else
+    {
+        if (pt->slabs == NULL || pt->slab_used == PIECE_SLAB_CAP)
+        {
+            PieceSlab *slab = malloc(sizeof(*slab));
+            assert(slab != NULL && "Failed to alloc piece slab");
+
+            slab->next = pt->slabs;
+            pt->slabs = slab;
+            pt->slabs_len += 1;
+            pt->slab_used = 0;
+        }
+
+        n = &pt->slabs->nodes[pt->slab_used++];
+    }
+
+    *n = (PieceNode){0};
+    return n;
+}
+
+void piece_node_release(PieceTable *pt, PieceNode *n)
+{
+    n->left = pt->free_pieces;
+    pt->free_pieces = n;
+    pt->free_pieces_len += 1;
+}
+
+void piece_slabs_free(PieceSlab *slab)
+{
+    while (slab != NULL)
+    {
+        PieceSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+PieceNode *piece_node_new(PieceTable *pt, PieceSource source, size_t start, size_t len)
+{
+    PieceNode *n = piece_node_alloc(pt);
+
+    // xorshift32, only needs to be good enough to keep the treap balanced
+    pt->seed ^= pt->seed << 13;
+    pt->seed ^= pt->seed >> 17;
+    pt->seed ^= pt->seed << 5;
+
+    n->priority = pt->seed;
+    n->source   = source;
+    n->start    = start;
+    n->len      = len;
+    n->lf       = piece_source_lf(pt, source, start, len);
+    n->total    = len;
+    n->lf_total = n->lf;
+    n->count    = 1;
+
+    return n;
+}
+
+void piece_node_free(PieceTable *pt, PieceNode *n)
+{
+    if (n == NULL) return;
+
+    piece_node_free(pt, n->left);
+    piece_node_free(pt, n->right);
+    piece_node_release(pt, n);
+}
+
+PieceNode *piece_node_merge(PieceNode *a, PieceNode *b)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->priority > b->priority)
+    {
+        a->right = piece_node_merge(a->right, b);
+        piece_node_update(a);
+        return a;
+    }
+
+    b->left = piece_node_merge(a, b->left);
+    piece_node_update(b);
+    return b;
+}
+
+// Splits `n` so that `l` holds the first `offset` bytes and `r` the rest,
+// cutting a piece in two when the offset falls inside of it.
+void piece_node_split(PieceTable *pt, PieceNode *n, size_t offset, PieceNode **l, PieceNode **r)
+{
+    if (n == NULL)
+    {
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+
+    size_t left_total = piece_node_total(n->left);
+
+    if (offset <= left_total)
+    {
+        piece_node_split(pt, n->left, offset, l, &n->left);
+        piece_node_update(n);
+        *r = n;
+    }
+    else if (offset >= left_total + n->len)
+    {
+        piece_node_split(pt, n->right, offset - left_total - n->len, &n->right, r);
+        piece_node_update(n);
+        *l = n;
+    }
+    else
+    {
+        size_t cut = offset - left_total;
+        PieceNode *tail = piece_node_new(pt, n->source, n->start + cut, n->len - cut);
+
+        *r = piece_node_merge(tail, n->right);
+
+        n->len = cut;
+        n->lf = piece_source_lf(pt, n->source, n->start, cut);
+        n->right = NULL;
+        piece_node_update(n);
+        *l = n;
+    }
+}
+
+// Grows the piece ending at `idx` when it is also the last thing appended to
+// `added`, so typing a run of characters keeps producing a single piece.
+int piece_node_extend(PieceNode *n, size_t idx, size_t added_end, size_t len, size_t lf)
+{
+    if (n == NULL) return 0;
+
+    size_t left_total = piece_node_total(n->left);
+    int extended = 0;
+
+    if (idx <= left_total)
+    {
+        extended = piece_node_extend(n->left, idx, added_end, len, lf);
+    }
+    else if (idx == left_total + n->len)
+    {
+        extended = n->source == PIECE_ADDED && n->start + n->len == added_end;
+        if (extended)
+        {
+            n->len += len;
+            n->lf  += lf;
+        }
+    }
+    else if (idx > left_total + n->len)
+    {
+        extended = piece_node_extend(n->right, idx - left_total - n->len, added_end, len, lf);
+    }
+
+    if (extended)
+    {
+        n->total    += len;
+        n->lf_total += lf;
+    }
+
+    return extended;
+}
+
+typedef struct {
+    PieceNode **data;
+    size_t len;
+    size_t cap;
+} PieceList;
+
+void piece_list_push(PieceList *list, PieceNode *n)
+{
+    if (list->len >= list->cap)
+    {
+        list->cap = list->cap == 0 ? 64 : list->cap * 2;
+        list->data = realloc(list->data, list->cap * sizeof(*list->data));
+        assert(list->data != NULL && "Failed to realloc piece list");
+    }
+
+    list->data[list->len++] = n;
+}
+
+// Pieces of the subtree in text order
+void piece_node_collect(PieceNode *n, PieceList *list)
+{
+    if (n == NULL) return;
+
+    piece_node_collect(n->left, list);
+    piece_list_push(list, n);
+    piece_node_collect(n->right, list);
+}
+
+void piece_node_update_all(PieceNode *n)
+{
+    if (n == NULL) return;
+
+    piece_node_update_all(n->left);
+    piece_node_update_all(n->right);
+    piece_node_update(n);
+}
+
+// Treap of the pieces in `list`, in that order, in O(pieces): each piece
+// hangs off the right spine of what was built before it, under the last one
+// with a higher priority
+PieceNode *piece_node_build(PieceList *list)
+{
+    if (list->len == 0) return NULL;
+
+    PieceNode **spine = malloc(list->len * sizeof(*spine));
+    assert(spine != NULL && "Failed to alloc piece spine");
+    size_t spine_len = 0;
+
+    for (size_t i = 0; i < list->len; i++)
+    {
+        PieceNode *n = list->data[i];
+        PieceNode *below = NULL;
+
+        while (spine_len > 0 && spine[spine_len - 1]->priority < n->priority) below = spine[--spine_len];
+
+        n->left = below;
+        n->right = NULL;
+        if (spine_len > 0) spine[spine_len - 1]->right = n;
+        spine[spine_len++] = n;
+    }
+
+    PieceNode *root = spine[0];
+    free(spine);
+
+    piece_node_update_all(root);
+    return root;
+}
+
+// Once the free pieces are twice the ones in the text, after a large delete,
+// the ones in the text move to new slabs and the old slabs are given back.
+// Costs O(pieces), paid for by the frees that got it there.
+void piece_table_shrink(PieceTable *pt)
+{
+    size_t live = piece_node_count(pt->root);
+    if (pt->free_pieces_len <= PIECE_SLAB_CAP || pt->free_pieces_len < 2 * live) return;
+
+    PieceList list = {0};
+    piece_node_collect(pt->root, &list);
+
+    PieceSlab *old = pt->slabs;
+    pt->slabs = NULL;
+    pt->slabs_len = 0;
+    pt->slab_used = 0;
+    pt->free_pieces = NULL;
+    pt->free_pieces_len = 0;
+
+    for (size_t i = 0; i < list.len; i++)
+    {
+        PieceNode *n = piece_node_alloc(pt);
+        *n = *list.data[i];
+        list.data[i] = n;
+    }
+
+    pt->root = piece_node_build(&list);
+
+    piece_slabs_free(old);
+    free(list.data);
+}
+
+// The pieces, the inserted bytes and where the newlines are, not the file
+// mapping
+MemoryUsage piece_table_usage(PieceTable *pt)
+{
+    MemoryUsage m = {0};
+
+    memory_usage_add(&m, piece_node_count(pt->root) * sizeof(PieceNode), pt->slabs_len * sizeof(PieceSlab));
+    memory_usage_add(&m, pt->added.len, pt->added.cap);
+    memory_usage_add(&m, pt->original_lines.len * sizeof(size_t), pt->original_lines.cap * sizeof(size_t));
+    memory_usage_add(&m, pt->added_lines.len * sizeof(size_t), pt->added_lines.cap * sizeof(size_t));
+
+    return m;
+}
+
+size_t piece_table_rows(PieceTable *pt)
+{
+    return piece_node_lf_total(pt->root) + 1;
+}
+
+// Row of the byte at `idx`, that is, how many newlines come before it
+size_t piece_table_row_of(PieceTable *pt, size_t idx)
+{
+    if (idx > pt->len) idx = pt->len;
+
+    PieceNode *n = pt->root;
+    size_t offset = idx;
+    size_t row = 0;
+
+    while (n != NULL)
+    {
+        size_t left_total = piece_node_total(n->left);
+
+        if (offset <= left_total)
+        {
+            n = n->left;
+            continue;
+        }
+
+        row += piece_node_lf_total(n->left);
+
+        if (offset <= left_total + n->len)
+        {
+            row += piece_source_lf(pt, n->source, n->start, offset - left_total);
+            break;
+        }
+
+        row += n->lf;
+        offset -= left_total + n->len;
+        n = n->right;
+    }
+
+    return row;
+}
+
+// Byte offset where `row` begins, or the length of the text past the last row
+size_t piece_table_row_start(PieceTable *pt, size_t row)
+{
+    if (row == 0) return 0;
+
+    PieceNode *n = pt->root;
+    size_t base = 0;
+
+    while (n != NULL)
+    {
+        size_t left_lf = piece_node_lf_total(n->left);
+
+        if (row <= left_lf)
+        {
+            n = n->left;
+            continue;
+        }
+
+        row  -= left_lf;
+        base += piece_node_total(n->left);
+
+        if (row <= n->lf)
+        {
+            Offsets *lines = piece_source_lines(pt, n->source);
+            size_t newline = lines->data[offsets_lower_bound(lines, n->start) + row - 1];
+            return base + newline - n->start + 1;
+        }
+
+        row  -= n->lf;
+        base += n->len;
+        n = n->right;
+    }
+
+    return pt->len;
+}
+
+void piece_table_log_rows(PieceTable *pt, RowRange rows)
+{
+    pt->edit_log[pt->edit_count % EDIT_LOG_CAP] = rows;
+    pt->edit_count += 1;
+}
+
+// Rows shift down from the first one when newlines come and go
+void piece_table_log_edit(PieceTable *pt, size_t idx, size_t lf)
+{
+    RowRange rows = {0};
+    rows.first = piece_table_row_of(pt, idx);
+    rows.last = lf > 0 ? SIZE_MAX : rows.first;
+
+    piece_table_log_rows(pt, rows);
+}
+
+// Union of the rows touched since the edit numbered `since`, returns 0 when
+// the log doesn't go back that far and everything has to be considered dirty
+int piece_table_edited_rows(PieceTable *pt, size_t since, RowRange *rows)
+{
+    if (since > pt->edit_count || pt->edit_count - since > EDIT_LOG_CAP) return 0;
+
+    *rows = (RowRange){SIZE_MAX, 0};
+
+    for (size_t i = since; i < pt->edit_count; i++)
+    {
+        RowRange edit = pt->edit_log[i % EDIT_LOG_CAP];
+        if (edit.first < rows->first) rows->first = edit.first;
+        if (edit.last > rows->last) rows->last = edit.last;
+    }
+
+    return 1;
+}
+
+void piece_table_init(PieceTable *pt)
+{
+    *pt = (PieceTable){0};
+    pt->seed = 0x9E3779B9;
+}
+
+// Gives back everything the table holds, leaving it empty. Edits keep being
+// numbered from where they were so nobody mistakes the old rows for new ones.
+void piece_table_free(PieceTable *pt)
+{
+    assert(pt->pins == 0 && "Piece table is pinned");
+
+    size_t edit_count = pt->edit_count;
+
+    piece_slabs_free(pt->slabs);
+    file_map_close(&pt->original);
+    free(pt->added.data);
+    free(pt->original_lines.data);
+    free(pt->added_lines.data);
+    free(pt->retired);
+
+    piece_table_init(pt);
+    pt->edit_count = edit_count;
+    piece_table_log_edit(pt, 0, 1);
+}
+
+// Adds `len` bytes of the original file starting at `start`, whose newlines
+// are `lines`, at the end of the text
+void piece_table_append_original(PieceTable *pt, size_t start, size_t len, const size_t *lines, size_t lines_len)
+{
+    if (len == 0) return;
+
+    for (size_t i = 0; i < lines_len; i++) offsets_push(&pt->original_lines, lines[i]);
+
+    size_t idx = pt->len;
+    PieceNode *piece = piece_node_new(pt, PIECE_ORIGINAL, start, len);
+    pt->root = piece_node_merge(pt->root, piece);
+
+    pt->len += len;
+    pt->span = NULL;
+
+    piece_table_log_edit(pt, idx, lines_len);
+}
+
+// Maps the file without adding any of it to the text yet
+int piece_table_map_file(PieceTable *pt, const char *file_path)
+{
+    piece_table_init(pt);
+    return file_map_open(&pt->original, file_path);
+}
+
+int piece_table_from_file(PieceTable *pt, const char *file_path)
+{
+    int ret = piece_table_map_file(pt, file_path);
+    if (ret < 0) return ret;
+
+    Offsets lines = {0};
+    offsets_push_newlines(&lines, pt->original.data, 0, pt->original.len);
+
+    piece_table_append_original(pt, 0, pt->original.len, lines.data, lines.len);
+    free(lines.data);
+
+    return ret;
+}
+
+// Keeps `data` alive until the last pin is gone. Heap memory is kept as a
+// FileMap with no length, mappings with theirs.
+void piece_table_retire(PieceTable *pt, const char *data, size_t len)
+{
+    if (pt->retired_len >= pt->retired_cap)
+    {
+        pt->retired_cap = pt->retired_cap == 0 ? 4 : pt->retired_cap * 2;
+        pt->retired = realloc(pt->retired, pt->retired_cap * sizeof(*pt->retired));
+        assert(pt->retired != NULL && "Failed to realloc retired list");
+    }
+
+    pt->retired[pt->retired_len++] = (FileMap){data, len};
+}
+
+void piece_table_pin(PieceTable *pt)
+{
+    pt->pins += 1;
+}
+
+void piece_table_unpin(PieceTable *pt)
+{
+    assert(pt->pins > 0 && "Piece table is not pinned");
+    if (--pt->pins > 0) return;
+
+    for (size_t i = 0; i < pt->retired_len; i++)
+    {
+        if (pt->retired[i].len > 0) file_map_close(&pt->retired[i]);
+        else free((void*)pt->retired[i].data);
+    }
+
+    pt->retired_len = 0;
+}
+
+// Appends to the added buffer without moving the bytes already there while
+// the table is pinned
+void piece_table_append_added(PieceTable *pt, const char *data, size_t len)
+{
+    String *added = &pt->added;
+
+    if (pt->pins > 0 && added->len + len >= added->cap && added->data != NULL)
+    {
+        String grown = {0};
+        grown.len = added->len + len;
+        string_check_capacity(&grown);
+
+        memcpy(grown.data, added->data, added->len);
+        grown.len = added->len;
+
+        piece_table_retire(pt, added->data, 0);
+        *added = grown;
+    }
+
+    string_append(added, data, len);
+}
+
+void piece_table_clear(PieceTable *pt)
+{
+    piece_node_free(pt, pt->root);
+    pt->root = NULL;
+    pt->len = 0;
+    piece_table_shrink(pt);
+
+    if (pt->pins > 0)
+    {
+        if (pt->original.len > 0) piece_table_retire(pt, pt->original.data, pt->original.len);
+        if (pt->added.data != NULL) piece_table_retire(pt, pt->added.data, 0);
+        pt->original = (FileMap){0};
+        pt->added = (String){0};
+    }
+
+    file_map_close(&pt->original);
+    pt->added.len = 0;
+    string_shrink(&pt->added);
+    pt->original_lines.len = 0;
+    pt->added_lines.len = 0;
+    pt->span = NULL;
+
+    piece_table_log_edit(pt, 0, 1);
+}
+
+void piece_table_insert(PieceTable *pt, size_t idx, const char *data, size_t len)
+{
+    if (idx > pt->len || len == 0) return;
+
+    size_t start = pt->added.len;
+    piece_table_append_added(pt, data, len);
+
+    size_t lines_before = pt->added_lines.len;
+    offsets_push_newlines(&pt->added_lines, data, start, len);
+    size_t lf = pt->added_lines.len - lines_before;
+
+    if (!piece_node_extend(pt->root, idx, start, len, lf))
+    {
+        PieceNode *l, *r;
+        piece_node_split(pt, pt->root, idx, &l, &r);
+
+        PieceNode *piece = piece_node_new(pt, PIECE_ADDED, start, len);
+        pt->root = piece_node_merge(piece_node_merge(l, piece), r);
+    }
+
+    pt->len += len;
+    pt->span = NULL;
+
+    piece_table_log_edit(pt, idx, lf);
+}
+
+void piece_table_delete(PieceTable *pt, size_t idx, size_t len)
+{
+    if (idx >= pt->len || len == 0) return;
+    if (len > pt->len - idx) len = pt->len - idx;
+
+    PieceNode *l, *mid, *deleted, *r;
+    piece_node_split(pt, pt->root, idx, &l, &mid);
+    piece_node_split(pt, mid, len, &deleted, &r);
+
+    size_t lf = piece_node_lf_total(deleted);
+    piece_node_free(pt, deleted);
+
+    pt->root = piece_node_merge(l, r);
+    piece_table_shrink(pt);
+    pt->len -= len;
+    pt->span = NULL;
+
+    piece_table_log_edit(pt, idx, lf);
+}
+
+// Adds a piece for `len` bytes of `added` from `start`, growing the last one
+// instead when it ends right there
+void piece_list_push_added(PieceTable *pt, PieceList *list, size_t start, size_t len, size_t lf)
+{
+    PieceNode *back = list->len > 0 ? list->data[list->len - 1] : NULL;
+
+    if (back != NULL && back->source == PIECE_ADDED && back->start + back->len == start)
+    {
+        back->len += len;
+        back->lf  += lf;
+        return;
+    }
+
+    piece_list_push(list, piece_node_new(pt, PIECE_ADDED, start, len));
+}
+
+// Replaces each of the `matches`, sorted and apart, with bytes of `added` as a
+// single edit; empty matches insert them. `with` holds a span of `added` for
+// every match, or only one that goes in at all of them. Unless the matches
+// are few next to the pieces, these are cut up and the treap rebuilt once in
+// one pass over them instead of a split and a merge per match. Returns where
+// the last replacement now starts.
+size_t piece_table_splice(PieceTable *pt, const Match *matches, size_t matches_len, const Match *with, size_t with_len)
+{
+    if (matches_len == 0) return 0;
+
+    const Match *back = &matches[matches_len - 1];
+    assert(back->start + back->len <= pt->len && "Match past the end of the text");
+    assert((with_len == 1 || with_len == matches_len) && "One replacement or one per match");
+
+    size_t old_lf = piece_node_lf_total(pt->root);
+    size_t m = 0;
+    size_t removed = 0;
+    size_t inserted = 0;
+    size_t inserted_lf = 0;
+
+    if (matches_len * 8 < piece_node_count(pt->root))
+    {
+        // Few matches among many pieces, a split and a merge for each costs
+        // less than going over all of them
+        PieceNode *out = NULL;
+        PieceNode *rest = pt->root;
+        size_t consumed = 0; // Old text before `rest`
+
+        for (; m < matches_len; m++)
+        {
+            PieceNode *l, *cut;
+            piece_node_split(pt, rest, matches[m].start - consumed, &l, &rest);
+            piece_node_split(pt, rest, matches[m].len, &cut, &rest);
+            piece_node_free(pt, cut);
+
+            out = piece_node_merge(out, l);
+            consumed = matches[m].start + matches[m].len;
+            removed += matches[m].len;
+
+            Match w = with[with_len == 1 ? 0 : m];
+            if (w.len == 0) continue;
+
+            size_t lf = piece_source_lf(pt, PIECE_ADDED, w.start, w.len);
+            inserted += w.len;
+            inserted_lf += lf;
+
+            if (!piece_node_extend(out, piece_node_total(out), w.start, w.len, lf))
+                out = piece_node_merge(out, piece_node_new(pt, PIECE_ADDED, w.start, w.len));
+        }
+
+        pt->root = piece_node_merge(out, rest);
+    }
+    else
+    {
+        PieceList old = {0};
+        piece_node_collect(pt->root, &old);
+
+        PieceList pieces = {0};
+        size_t done = 0; // Text before this has been cut up
+
+        for (size_t i = 0, pos = 0, end = 0; i < old.len; i++, pos = end)
+        {
+            PieceNode *p = old.data[i];
+            end = pos + p->len;
+
+            if (done == pos && (m == matches_len || matches[m].start >= end))
+            {
+                piece_list_push(&pieces, p);
+                done = end;
+                continue;
+            }
+
+            while (done < end)
+            {
+                size_t upto = m < matches_len && matches[m].start < end ? matches[m].start : end;
+
+                if (upto > done) piece_list_push(&pieces, piece_node_new(pt, p->source, p->start + done - pos, upto - done));
+                done = upto;
+
+                if (upto == end) break;
+
+                // A match can run on into the next pieces, they skip up to its end
+                Match w = with[with_len == 1 ? 0 : m];
+                size_t lf = piece_source_lf(pt, PIECE_ADDED, w.start, w.len);
+                if (w.len > 0) piece_list_push_added(pt, &pieces, w.start, w.len, lf);
+
+                inserted += w.len;
+                inserted_lf += lf;
+                done = matches[m].start + matches[m].len;
+                removed += matches[m].len;
+                m += 1;
+            }
+
+            piece_node_release(pt, p);
+        }
+
+        // Empty matches at the very end
+        for (; m < matches_len; m++)
+        {
+            Match w = with[with_len == 1 ? 0 : m];
+            size_t lf = piece_source_lf(pt, PIECE_ADDED, w.start, w.len);
+            if (w.len > 0) piece_list_push_added(pt, &pieces, w.start, w.len, lf);
+
+            inserted += w.len;
+            inserted_lf += lf;
+        }
+
+        free(old.data);
+
+        pt->root = piece_node_build(&pieces);
+        free(pieces.data);
+    }
+
+    pt->len = pt->len - removed + inserted;
+    pt->span = NULL;
+    piece_table_shrink(pt);
+
+    size_t last = back->start - (removed - back->len) + (inserted - with[with_len == 1 ? 0 : m - 1].len);
+
+    // Without a newline going or coming the rows stay where they were
+    RowRange rows = {0};
+    rows.first = piece_table_row_of(pt, matches[0].start);
+    rows.last = inserted_lf > 0 || piece_node_lf_total(pt->root) != old_lf ? SIZE_MAX : piece_table_row_of(pt, last);
+    piece_table_log_rows(pt, rows);
+
+    // The rows after each match move by a different amount, logged twice so
+    // it isn't taken for an edit at a single place
+    if (rows.last == SIZE_MAX && matches_len > 1) piece_table_log_rows(pt, rows);
+
+    return last;
+}
+
+// Replaces each of the `matches` with `with`, see piece_table_splice. Every
+// replacement points at the same copy of it.
+size_t piece_table_replace(PieceTable *pt, const Match *matches, size_t matches_len, const char *with, size_t with_len)
+{
+    if (matches_len == 0) return 0;
+
+    Match span = {pt->added.len, with_len};
+
+    if (with_len > 0)
+    {
+        piece_table_append_added(pt, with, with_len);
+        offsets_push_newlines(&pt->added_lines, with, span.start, with_len);
+    }
+
+    return piece_table_splice(pt, matches, matches_len, &span, 1);
+}
+
+// Replaces match k with bytes with[k] of `data`, see piece_table_splice.
+// Matches given the same bytes as the one before share a copy of them, and
+// bytes that follow on in `data` are copied in together.
+size_t piece_table_replace_each(PieceTable *pt, const Match *matches, size_t matches_len, const char *data, const Match *with)
+{
+    if (matches_len == 0) return 0;
+
+    Match *spans = malloc(matches_len * sizeof(*spans));
+    assert(spans != NULL && "Failed to alloc replacement spans");
+
+    // Bytes of `data` from `run` on are still to be copied, to `run_at`
+    size_t run = 0, run_len = 0, run_at = pt->added.len;
+
+    for (size_t k = 0; k < matches_len; k++)
+    {
+        if (k > 0 && with[k].start == with[k - 1].start && with[k].len == with[k - 1].len)
+        {
+            spans[k] = spans[k - 1];
+            continue;
+        }
+
+        if (with[k].start != run + run_len)
+        {
+            if (run_len > 0)
+            {
+                piece_table_append_added(pt, data + run, run_len);
+                offsets_push_newlines(&pt->added_lines, data + run, run_at, run_len);
+            }
+
+            run = with[k].start;
+            run_len = 0;
+            run_at = pt->added.len;
+        }
+
+        spans[k] = (Match){run_at + run_len, with[k].len};
+        run_len += with[k].len;
+    }
+
+    if (run_len > 0)
+    {
+        piece_table_append_added(pt, data + run, run_len);
+        offsets_push_newlines(&pt->added_lines, data + run, run_at, run_len);
+    }
+
+    size_t last = piece_table_splice(pt, matches, matches_len, spans, matches_len);
+    free(spans);
+
+    return last;
+}
+
+// Returns the contiguous bytes starting at `idx` and stores how many there
+// are in `span_len`.
+const char *piece_table_span(PieceTable *pt, size_t idx, size_t *span_len)
+{
+    if (idx >= pt->len)
+    {
+        *span_len = 0;
+        return NULL;
+    }
+
+    if (pt->span == NULL || idx < pt->span_begin || idx >= pt->span_begin + pt->span_len)
+    {
+        PieceNode *n = pt->root;
+        size_t offset = idx;
+
+        while (n != NULL)
+        {
+            size_t left_total = piece_node_total(n->left);
+
+            if (offset < left_total)
+            {
+                n = n->left;
+            }
+            else if (offset < left_total + n->len)
+            {
+                offset -= left_total;
+                break;
+            }
+            else
+            {
+                offset -= left_total + n->len;
+                n = n->right;
+            }
+        }
+
+        assert(n != NULL && "Piece table is out of sync");
+
+        const char *source = n->source == PIECE_ORIGINAL ? pt->original.data : pt->added.data;
+        pt->span       = source + n->start;
+        pt->span_begin = idx - offset;
+        pt->span_len   = n->len;
+    }
+
+    *span_len = pt->span_begin + pt->span_len - idx;
+    return pt->span + (idx - pt->span_begin);
+}
+
+char piece_table_get(PieceTable *pt, size_t idx)
+{
+    size_t span_len = 0;
+    const char *span = piece_table_span(pt, idx, &span_len);
+
+    return span != NULL ? span[0] : '\0';
+}
+
+size_t piece_table_read(PieceTable *pt, size_t idx, size_t len, char *dst)
+{
+    size_t copied = 0;
+
+    while (copied < len)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(pt, idx + copied, &span_len);
+        if (span == NULL) break;
+
+        if (span_len > len - copied) span_len = len - copied;
+
+        memcpy(dst + copied, span, span_len);
+        copied += span_len;
+    }
+
+    return copied;
+}
+
+size_t piece_table_count_codepoints(PieceTable *pt, size_t start, size_t end)
+{
+    size_t count = 0;
+
+    while (start < end)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(pt, start, &span_len);
+        if (span == NULL) break;
+
+        if (span_len > end - start) span_len = end - start;
+
+        count += scan_count_codepoints(span, span_len);
+        start += span_len;
+    }
+
+    return count;
+}
+
+// Position of the `count`-th codepoint after `start`, without going past `end`
+size_t piece_table_skip_codepoints(PieceTable *pt, size_t start, size_t end, size_t count)
+{
+    size_t seen = 0;
+
+    while (start < end)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(pt, start, &span_len);
+        if (span == NULL) break;
+
+        if (span_len > end - start) span_len = end - start;
+
+        // Whole spans before the one holding the target are only counted
+        size_t span_count = scan_count_codepoints(span, span_len);
+
+        if (seen + span_count <= count)
+        {
+            seen += span_count;
+            start += span_len;
+            continue;
+        }
+
+        for (size_t i = 0; i < span_len; i++)
+        {
+            if ((span[i] & 0xC0) == 0x80) continue;
+            if (seen == count) return start + i;
+            seen += 1;
+        }
+
+        start += span_len;
+    }
+
+    return end;
+}
+
+// Position of the first newline at or after `idx`, the length when there is none
+size_t piece_table_next_newline(PieceTable *pt, size_t idx)
+{
+    while (idx < pt->len)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(pt, idx, &span_len);
+
+        size_t found = scan_next_newline(span, span_len);
+        if (found < span_len) return idx + found;
+
+        idx += span_len;
+    }
+
+    return pt->len;
+}
+
+// Start of the line holding `idx`, just past the last newline before it
+size_t piece_table_line_begin(PieceTable *pt, size_t idx)
+{
+    while (idx > 0)
+    {
+        // The span cache holds the whole piece, scan it back from `idx`
+        size_t span_len = 0;
+        piece_table_span(pt, idx - 1, &span_len);
+
+        size_t begin = pt->span_begin;
+        size_t found = scan_prev_newline(pt->span, idx - begin);
+        if (found != SIZE_MAX) return begin + found + 1;
+
+        idx = begin;
+    }
+
+    return 0;
+}
+
+// Loader: indexes the newlines of a mapped file on a worker thread, one chunk
+// at a time. The UI thread takes whatever was indexed since the last frame
+// and appends it to the text, so the top of a file can be shown and edited
+// while the rest is still being read.
+
+#define LOAD_CHUNK (4*1024*1024)
+
+typedef struct {
+    pthread_t thread;
+    atomic_int cancel;
+
+    const char *data;
+    size_t len;
+
+    // Guarded by `lock`
+    pthread_mutex_t lock;
+    size_t scanned;
+    Offsets lines; // Newlines in the bytes scanned but not taken yet
+
+    size_t taken; // Bytes already in the text, only used by the UI thread
+} Loader;
+
+void *loader_run(void *arg)
+{
+    Loader *l = arg;
+    Offsets found = {0};
+
+    for (size_t at = l->scanned; at < l->len && !atomic_load(&l->cancel);)
+    {
+        size_t len = l->len - at < LOAD_CHUNK ? l->len - at : LOAD_CHUNK;
+
+        found.len = 0;
+        offsets_push_newlines(&found, l->data + at, at, len);
+        at += len;
+
+        pthread_mutex_lock(&l->lock);
+        for (size_t i = 0; i < found.len; i++) offsets_push(&l->lines, found.data[i]);
+        l->scanned = at;
+        pthread_mutex_unlock(&l->lock);
+    }
+
+    free(found.data);
+    return NULL;
+}
+
+// Starts indexing `data` from `scanned` on
+Loader *loader_start(const char *data, size_t len, size_t scanned)
+{
+    Loader *l = calloc(1, sizeof(*l));
+    assert(l != NULL && "Failed to alloc loader");
+
+    l->data = data;
+    l->len = len;
+    l->scanned = scanned;
+    l->taken = scanned;
+    pthread_mutex_init(&l->lock, NULL);
+
+    int ret = pthread_create(&l->thread, NULL, loader_run, l);
+    assert(ret == 0 && "Failed to start loader");
+
+    return l;
+}
+
+void loader_free(Loader *l)
+{
+    atomic_store(&l->cancel, 1);
+    pthread_join(l->thread, NULL);
+
+    pthread_mutex_destroy(&l->lock);
+    free(l->lines.data);
+    free(l);
+}
+
+// Highlighter: the lexer state at the end of every row is kept, so a row can
+// be colored by lexing just that row. Rows are lexed in order and only as far
+// down as something is shown. An edit only throws away the states from the
+// edited row on: the ones after are shifted along with their rows and kept
+// aside, and lexing again stops at the first row that ends in the same state
+// as before, from there on nothing changed.
+
+typedef struct {
+    const Language *lang; // NULL for plain text
+
+    PieceTable *text;
+    size_t edit_count;
+    size_t rows; // Rows of the text when last synced
+
+    // State at the end of each row. Rows below `valid` are up to date, rows
+    // from `valid` to `known` hold the states from before the last edits,
+    // which can only be trusted again from row `resync` on.
+    SyntaxState *states;
+    size_t states_cap;
+    size_t valid;
+    size_t known;
+    size_t resync;
+
+    // Rows whose colors may have changed while lexing, besides the edited
+    // ones, for the renderer to pick up
+    RowRange recolored;
+
+    // Scratch for the row being lexed and the kind of each of its bytes
+    char *line;
+    unsigned char *kinds;
+    size_t line_cap;
+
+    size_t rows_lexed;
+} Highlighter;
+
+void highlighter_init(Highlighter *hl, PieceTable *text, const char *filepath)
+{
+    *hl = (Highlighter){0};
+    hl->lang = syntax_detect(filepath);
+    hl->text = text;
+    hl->recolored = (RowRange){SIZE_MAX, 0};
+}
+
+void highlighter_free(Highlighter *hl)
+{
+    free(hl->states);
+    free(hl->line);
+    free(hl->kinds);
+    highlighter_init(hl, hl->text, "");
+}
+
+MemoryUsage highlighter_usage(Highlighter *hl)
+{
+    MemoryUsage m = {0};
+
+    memory_usage_add(&m, hl->known * sizeof(*hl->states), hl->states_cap * sizeof(*hl->states));
+    memory_usage_add(&m, 2 * hl->line_cap, 2 * hl->line_cap);
+
+    return m;
+}
+
+void highlighter_reserve(Highlighter *hl, size_t rows)
+{
+    if (hl->states_cap >= rows) return;
+
+    hl->states_cap = hl->states_cap == 0 ? 1024 : hl->states_cap;
+    while (hl->states_cap < rows) hl->states_cap *= 2;
+
+    hl->states = realloc(hl->states, hl->states_cap * sizeof(*hl->states));
+    assert(hl->states != NULL && "Failed to realloc highlighter states");
+}
+
+// Catches up with the edits made to the text since the last call
+void highlighter_sync(Highlighter *hl)
+{
+    PieceTable *text = hl->text;
+    if (hl->edit_count == text->edit_count) return;
+
+    size_t rows = piece_table_rows(text);
+    RowRange edited = {0};
+
+    if (!piece_table_edited_rows(text, hl->edit_count, &edited)) edited.first = 0;
+
+    if (edited.first < hl->valid) hl->valid = edited.first;
+
+    // The row count only tells how far the rows after a single edit moved,
+    // after more than one the old states are of no use
+    long delta = (long)rows - (long)hl->rows;
+    size_t from = edited.first + (delta > 0 ? delta : 0); // First row that was there before
+    size_t from_old = from - delta;
+
+    if (text->edit_count - hl->edit_count == 1 && hl->known > from_old)
+    {
+        highlighter_reserve(hl, hl->known + delta);
+        memmove(hl->states + from, hl->states + from_old, (hl->known - from_old) * sizeof(*hl->states));
+        hl->known += delta;
+
+        // An older edit further down still holds
+        size_t resync = hl->resync > edited.first ? hl->resync + delta : 0;
+        hl->resync = resync > from ? resync : from;
+    }
+    else
+    {
+        hl->known = hl->valid;
+    }
+
+    hl->edit_count = text->edit_count;
+    hl->rows = rows;
+
+    // A lot fewer rows than there were, after a large delete
+    if (hl->states_cap > 1024 && hl->states_cap / 4 > rows && hl->states_cap / 4 > hl->known)
+    {
+        size_t cap = 1024;
+        while (cap < rows || cap < hl->known) cap *= 2;
+
+        hl->states = realloc(hl->states, cap * sizeof(*hl->states));
+        assert(hl->states != NULL && "Failed to realloc highlighter states");
+        hl->states_cap = cap;
+    }
+}
+
+// Lexes `row` starting from `state` into the scratch kinds, returns the state
+// it ends in and its length
+SyntaxState highlighter_lex_row(Highlighter *hl, size_t row, SyntaxState state, size_t *len)
+{
+    PieceTable *text = hl->text;
+
+    size_t begin = piece_table_row_start(text, row);
+    size_t end = piece_table_row_start(text, row + 1);
+    if (row + 1 < piece_table_rows(text)) end -= 1;
+
+    *len = end - begin;
+
+    if (hl->line_cap < *len)
+    {
+        hl->line_cap = *len;
+        hl->line = realloc(hl->line, hl->line_cap);
+        hl->kinds = realloc(hl->kinds, hl->line_cap);
+        assert(hl->line != NULL && hl->kinds != NULL && "Failed to realloc highlighter line");
+    }
+
+    piece_table_read(text, begin, *len, hl->line);
+    hl->rows_lexed += 1;
+
+    return hl->lang->lex(state, hl->line, *len, hl->kinds);
+}
+
+void highlighter_recolor(Highlighter *hl, size_t row)
+{
+    if (row < hl->recolored.first) hl->recolored.first = row;
+    if (row > hl->recolored.last) hl->recolored.last = row;
+}
+
+// Brings the end states of every row before `row` up to date
+void highlighter_advance(Highlighter *hl, size_t row)
+{
+    if (hl->lang == NULL) return;
+
+    highlighter_sync(hl);
+
+    size_t rows = piece_table_rows(hl->text);
+    if (row > rows) row = rows;
+
+    highlighter_reserve(hl, row);
+
+    // Whether the row about to be lexed starts in the state it was painted
+    // with, only then its colors stay the same
+    int same_start = 1;
+
+    while (hl->valid < row)
+    {
+        size_t n = hl->valid;
+        SyntaxState in = n == 0 ? 0 : hl->states[n-1];
+
+        size_t len = 0;
+        SyntaxState out = highlighter_lex_row(hl, n, in, &len);
+
+        if (!same_start) highlighter_recolor(hl, n);
+
+        if (n >= hl->resync && n < hl->known && hl->states[n] == out)
+        {
+            // Same text from here on, starting in the same state
+            hl->valid = hl->known;
+            break;
+        }
+
+        same_start = 0;
+        hl->states[n] = out;
+        hl->valid = n + 1;
+        if (hl->known < hl->valid) hl->known = hl->valid;
+
+        // Stopped short of a match, the rows lexed so far no longer lead
+        // into the old states after them
+        if (hl->valid == row && hl->resync < row) hl->resync = row;
+    }
+}
+
+// Kind of every byte of `row`, NULL for plain text. Stays valid until the
+// next call.
+const unsigned char *highlighter_row(Highlighter *hl, size_t row, size_t *len)
+{
+    if (hl->lang == NULL) return NULL;
+
+    highlighter_advance(hl, row);
+
+    SyntaxState in = row == 0 ? 0 : hl->states[row-1];
+    highlighter_lex_row(hl, row, in, len);
+
+    return hl->kinds;
+}
+
+// WrapLayout: with soft wrapping on, a row longer than `width` codepoints is shown
+// as several visual rows. The codepoints of every row are counted once and
+// kept, so a new width only divides again and never reads the text. The
+// visual rows of each row go into a Fenwick tree, which turns a visual row
+// into a row and back in O(log n). Rows are counted and divided a slice at a
+// time in the background, the ones on screen right away, and until then a
+// row keeps the visual rows it had, one if it was never counted. An edit only
+// has the rows it touched counted again.
+
+#define WRAP_UNCOUNTED UINT32_MAX
+#define WRAP_SLICE (1024*1024) // Bytes counted per call to wrap_advance
+#define WRAP_ROW_COST 16       // Rows divided cost as many bytes
+
+typedef struct {
+    PieceTable *text;
+    size_t edit_count;
+    size_t rows; // Rows of the text when last synced
+
+    size_t width; // Codepoints per visual row, 0 when not wrapping
+
+    // Codepoints of each row, WRAP_UNCOUNTED until counted, and the visual
+    // rows each one has in the tree
+    uint32_t *cols;
+    uint32_t *shown;
+    size_t cap;
+
+    // Sums of `shown`, one-based. Nodes past row `tree_from` need rebuilding
+    // after rows came or went, SIZE_MAX when none do.
+    size_t *tree;
+    size_t tree_from;
+
+    // Rows below are counted and divided at the current width
+    size_t done;
+} WrapLayout;
+
+void wrap_layout_init(WrapLayout *w, PieceTable *text)
+{
+    *w = (WrapLayout){0};
+    w->text = text;
+}
+
+// Drops the layout but keeps wrapping, it is made again from the text
+void wrap_layout_free(WrapLayout *w)
+{
+    size_t width = w->width;
+
+    free(w->cols);
+    free(w->shown);
+    free(w->tree);
+
+    wrap_layout_init(w, w->text);
+    w->width = width;
+}
+
+MemoryUsage wrap_layout_usage(WrapLayout *w)
+{
+    MemoryUsage m = {0};
+    size_t row_size = sizeof(*w->cols) + sizeof(*w->shown) + sizeof(*w->tree);
+
+    memory_usage_add(&m, w->rows * row_size, w->cap * row_size);
+
+    return m;
+}
+
+void wrap_layout_resize(WrapLayout *w, size_t cap)
+{
+    w->cols = realloc(w->cols, cap * sizeof(*w->cols));
+    w->shown = realloc(w->shown, cap * sizeof(*w->shown));
+    w->tree = realloc(w->tree, (cap + 1) * sizeof(*w->tree));
+    assert(w->cols != NULL && w->shown != NULL && w->tree != NULL && "Failed to realloc wrap layout");
+
+    w->cap = cap;
+}
+
+void wrap_layout_reserve(WrapLayout *w, size_t rows)
+{
+    if (w->cap >= rows) return;
+
+    size_t cap = w->cap == 0 ? 1024 : w->cap;
+    while (cap < rows) cap *= 2;
+
+    wrap_layout_resize(w, cap);
+}
+
+// Gives `row` `n` visual rows
+void wrap_layout_show(WrapLayout *w, size_t row, uint32_t n)
+{
+    if (w->shown[row] == n) return;
+
+    // Nodes past `tree_from` are summed again anyway
+    if (row < w->tree_from)
+    {
+        size_t delta = (size_t)n - w->shown[row];
+        for (size_t i = row + 1; i <= w->rows; i += i & -i) w->tree[i] += delta;
+    }
+
+    w->shown[row] = n;
+}
+
+// Catches up with the edits made to the text since the last call
+void wrap_layout_sync(WrapLayout *w)
+{
+    PieceTable *text = w->text;
+    size_t rows = piece_table_rows(text);
+
+    if (w->edit_count == text->edit_count && w->rows == rows) return;
+
+    RowRange edited = {0};
+    if (!piece_table_edited_rows(text, w->edit_count, &edited)) edited = (RowRange){0, SIZE_MAX};
+
+    size_t first = edited.first < w->rows ? edited.first : w->rows;
+    long delta = (long)rows - (long)w->rows;
+
+    // Rows `first` to `from` are counted again, the ones after are the old
+    // ones from `from_old` on. Only a single edit tells how far they moved.
+    size_t from_old = w->rows, from = rows;
+
+    if (edited.last != SIZE_MAX)
+    {
+        from_old = edited.last + 1;
+        from = from_old;
+    }
+    else if (text->edit_count - w->edit_count == 1)
+    {
+        from_old = first + 1 + (delta < 0 ? -delta : 0);
+        from = from_old + delta;
+    }
+
+    if (from_old > w->rows || from > rows)
+    {
+        from_old = w->rows;
+        from = rows;
+    }
+
+    wrap_layout_reserve(w, rows);
+
+    if (delta != 0)
+    {
+        memmove(w->cols + from, w->cols + from_old, (w->rows - from_old) * sizeof(*w->cols));
+        memmove(w->shown + from, w->shown + from_old, (w->rows - from_old) * sizeof(*w->shown));
+        w->rows = rows;
+        if (first < w->tree_from) w->tree_from = first;
+    }
+
+    for (size_t row = first; row < from; row++)
+    {
+        w->cols[row] = WRAP_UNCOUNTED;
+        wrap_layout_show(w, row, 1);
+    }
+
+    if (first < w->done) w->done = first;
+    w->edit_count = text->edit_count;
+
+    // A lot fewer rows than there were, after a large delete
+    if (w->cap > 1024 && w->cap / 4 > rows)
+    {
+        size_t cap = 1024;
+        while (cap < rows) cap *= 2;
+        wrap_layout_resize(w, cap);
+    }
+}
+
+// Sums the nodes that went stale, O(n) for the rows from `tree_from` on
+void wrap_layout_build(WrapLayout *w)
+{
+    if (w->tree_from >= w->rows) return;
+
+    for (size_t i = w->tree_from + 1; i <= w->rows; i++)
+    {
+        // Every node covers the `i & -i` rows up to its own, the ones before
+        // it are its children
+        size_t sum = w->shown[i-1];
+        for (size_t k = 1; k < (i & -i); k *= 2) sum += w->tree[i-k];
+        w->tree[i] = sum;
+    }
+
+    w->tree_from = SIZE_MAX;
+}
+
+// Counts the codepoints of `row`, which starts at `begin`, returns where it
+// ends
+size_t wrap_layout_count(WrapLayout *w, size_t row, size_t begin)
+{
+    size_t end = piece_table_next_newline(w->text, begin);
+    size_t cols = piece_table_count_codepoints(w->text, begin, end);
+
+    w->cols[row] = cols < WRAP_UNCOUNTED ? (uint32_t)cols : WRAP_UNCOUNTED - 1;
+    return end;
+}
+
+void wrap_layout_divide(WrapLayout *w, size_t row)
+{
+    size_t cols = w->cols[row];
+    size_t n = cols == 0 ? 1 : (cols + w->width - 1) / w->width;
+
+    wrap_layout_show(w, row, (uint32_t)n);
+}
+
+// Wrapping starts over from the text at a new width, 0 turns it off and
+// frees the layout
+void wrap_layout_set_width(WrapLayout *w, size_t width)
+{
+    if (w->width == width) return;
+
+    if (width == 0 || w->width == 0) wrap_layout_free(w);
+
+    // What was counted stays, everything gets divided again
+    w->width = width;
+    w->done = 0;
+}
+
+// Visual rows of `row`, counted and divided right away if it wasn't yet
+size_t wrap_layout_rows_of(WrapLayout *w, size_t row)
+{
+    if (w->width == 0) return 1;
+
+    wrap_layout_sync(w);
+    if (row >= w->rows) return 1;
+
+    if (w->cols[row] == WRAP_UNCOUNTED) wrap_layout_count(w, row, piece_table_row_start(w->text, row));
+    wrap_layout_divide(w, row);
+
+    return w->shown[row];
+}
+
+// Visual rows before `row`. Past the end every row counts as one, the same
+// as when not wrapping.
+size_t wrap_layout_visual_row(WrapLayout *w, size_t row)
+{
+    if (w->width == 0) return row;
+
+    wrap_layout_sync(w);
+    wrap_layout_build(w);
+
+    size_t extra = 0;
+    if (row > w->rows)
+    {
+        extra = row - w->rows;
+        row = w->rows;
+    }
+
+    size_t sum = 0;
+    for (size_t i = row; i > 0; i -= i & -i) sum += w->tree[i];
+
+    return sum + extra;
+}
+
+// Row shown on `visual`, and which of its visual rows that is in `sub`
+size_t wrap_layout_find(WrapLayout *w, size_t visual, size_t *sub)
+{
+    *sub = 0;
+    if (w->width == 0) return visual;
+
+    wrap_layout_sync(w);
+    wrap_layout_build(w);
+
+    size_t step = 1;
+    while (step * 2 <= w->rows) step *= 2;
+
+    // Rows whose visual rows all come before `visual`
+    size_t row = 0;
+
+    for (; step > 0; step /= 2)
+    {
+        if (row + step <= w->rows && w->tree[row + step] <= visual)
+        {
+            row += step;
+            visual -= w->tree[row];
+        }
+    }
+
+    if (row >= w->rows) return row + visual;
+
+    *sub = visual;
+    return row;
+}
+
+// Which visual row of `row` has column `col`, and at what column of it in
+// `vcol`. The end of a row that fills its last visual row stays on it.
+size_t wrap_layout_sub_row(WrapLayout *w, size_t row, size_t col, size_t *vcol)
+{
+    *vcol = col;
+    if (w->width == 0) return 0;
+
+    size_t sub = col / w->width;
+    size_t rows = wrap_layout_rows_of(w, row);
+    if (sub >= rows) sub = rows - 1;
+
+    *vcol = col - sub * w->width;
+    return sub;
+}
+
+// Visual row and column of column `col` of `row`
+size_t wrap_layout_locate(WrapLayout *w, size_t row, size_t col, size_t *vcol)
+{
+    size_t sub = wrap_layout_sub_row(w, row, col, vcol);
+    return wrap_layout_visual_row(w, row) + sub;
+}
+
+// Counts and divides the next rows in order until `budget` bytes are spent,
+// returns 1 while some are left
+int wrap_layout_advance(WrapLayout *w, size_t budget)
+{
+    if (w->width == 0) return 0;
+
+    wrap_layout_sync(w);
+
+    size_t spent = 0;
+    size_t begin = SIZE_MAX; // Of the row being counted, when known
+
+    while (w->done < w->rows && spent < budget)
+    {
+        size_t row = w->done++;
+        spent += WRAP_ROW_COST;
+
+        if (w->cols[row] == WRAP_UNCOUNTED)
+        {
+            if (begin == SIZE_MAX) begin = piece_table_row_start(w->text, row);
+
+            size_t end = wrap_layout_count(w, row, begin);
+            spent += end - begin;
+            begin = end + 1;
+        }
+        else
+        {
+            begin = SIZE_MAX;
+        }
+
+        wrap_layout_divide(w, row);
+    }
+
+    return w->done < w->rows;
+}
+
+// History: the edits made to a buffer for undo and redo. An edit puts the same
+// bytes in at one or more places, so it keeps them once, and for every place
+// only its offset and how many bytes it took out, never a copy of the text.
+// The bytes go one after the other into an arena that only grows at the end,
+// and when it all goes over `cap` the oldest steps are dropped. Edits made
+// while a group is open, the keystrokes of one insert, are undone as one
+// step, and typing on at the end of the last insert grows it instead of
+// adding another.
+
+#define HISTORY_CAP (64*1024*1024)
+
+typedef struct {
+    size_t offset;  // In the text as the edit found it
+    size_t removed; // Bytes taken out
+} HistoryDelta;
+
+typedef struct {
+    size_t delta;    // First of its deltas, they run up to the next edit's
+    size_t data;     // In the arena, the bytes put in and then the ones each delta took out
+    size_t inserted; // Bytes put in
+    size_t cursor;   // Before it
+    int step;        // Undo stops here
+} HistoryEdit;
+
+typedef struct {
+    String arena;
+    HistoryDelta *deltas;
+    size_t deltas_len;
+    size_t deltas_cap;
+    HistoryEdit *edits;
+    size_t edits_len;
+    size_t edits_cap;
+    size_t now; // Edits done, the ones after it can be redone
+    size_t cap; // Bytes it may use, nothing is kept while 0
+
+    int group;   // Edits join the step the first one starts
+    int grouped; // That step has been started
+} History;
+
+size_t history_memory(History *h)
+{
+    return h->arena.len + h->deltas_len * sizeof(*h->deltas) + h->edits_len * sizeof(*h->edits);
+}
+
+MemoryUsage history_usage(History *h)
+{
+    MemoryUsage m = {0};
+
+    memory_usage_add(&m, h->arena.len, h->arena.cap);
+    memory_usage_add(&m, h->deltas_len * sizeof(*h->deltas), h->deltas_cap * sizeof(*h->deltas));
+    memory_usage_add(&m, h->edits_len * sizeof(*h->edits), h->edits_cap * sizeof(*h->edits));
+
+    return m;
+}
+
+void history_free(History *h)
+{
+    free(h->arena.data);
+    free(h->deltas);
+    free(h->edits);
+
+    size_t cap = h->cap;
+    *h = (History){0};
+    h->cap = cap;
+}
+
+size_t history_deltas_end(History *h, size_t edit)
+{
+    return edit + 1 < h->edits_len ? h->edits[edit + 1].delta : h->deltas_len;
+}
+
+// Drops the oldest steps until it uses at most `budget` bytes
+void history_trim(History *h, size_t budget)
+{
+    size_t drop = 0;
+
+    while (drop < h->edits_len)
+    {
+        HistoryEdit *e = &h->edits[drop];
+        size_t left = h->arena.len - e->data + (h->deltas_len - e->delta) * sizeof(*h->deltas) + (h->edits_len - drop) * sizeof(*h->edits);
+        if (e->step && left <= budget) break;
+        drop += 1;
+    }
+
+    if (drop == 0) return;
+
+    // Edits to redo can't be kept without the ones before them
+    if (drop >= h->edits_len || drop > h->now)
+    {
+        history_free(h);
+        return;
+    }
+
+    size_t deltas = h->edits[drop].delta;
+    size_t data = h->edits[drop].data;
+
+    memmove(h->arena.data, h->arena.data + data, h->arena.len - data);
+    h->arena.len -= data;
+
+    memmove(h->deltas, h->deltas + deltas, (h->deltas_len - deltas) * sizeof(*h->deltas));
+    h->deltas_len -= deltas;
+
+    memmove(h->edits, h->edits + drop, (h->edits_len - drop) * sizeof(*h->edits));
+    h->edits_len -= drop;
+    h->now -= drop;
+
+    for (size_t i = 0; i < h->edits_len; i++)
+    {
+        h->edits[i].delta -= deltas;
+        h->edits[i].data -= data;
+    }
+
+    string_shrink(&h->arena);
+}
+
+// Grows the last edit instead of logging a new one, when it is a lone insert
+// in the open step that this one types on at the end of or backspaces into
+int history_coalesce(History *h, Match match, const char *with, size_t with_len)
+{
+    if (!h->grouped || h->now == 0 || h->now != h->edits_len) return 0;
+
+    HistoryEdit *e = &h->edits[h->now - 1];
+    if (history_deltas_end(h, h->now - 1) - e->delta != 1) return 0;
+
+    HistoryDelta *d = &h->deltas[e->delta];
+    size_t end = d->offset + e->inserted;
+
+    // Its inserted bytes have to be the last ones in the arena
+    if (d->removed != 0) return 0;
+
+    if (match.len == 0 && with_len > 0 && match.start == end && history_memory(h) + with_len <= h->cap)
+    {
+        string_append(&h->arena, with, with_len);
+        e->inserted += with_len;
+        return 1;
+    }
+
+    if (with_len == 0 && match.len > 0 && match.start >= d->offset && match.start + match.len == end)
+    {
+        h->arena.len -= match.len;
+        e->inserted -= match.len;
+
+        // Typed and all backspaced again, there is nothing left to undo
+        if (e->inserted == 0 && e->step)
+        {
+            h->deltas_len -= 1;
+            h->edits_len -= 1;
+            h->now -= 1;
+            h->grouped = 0;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Logs an edit that is about to replace each of the `matches`, sorted and
+// apart, with `with`. Called before making it, the bytes taken out are read
+// from `text` as it still is.
+void history_record(History *h, PieceTable *text, const Match *matches, size_t matches_len, const char *with, size_t with_len, size_t cursor)
+{
+    if (h->cap == 0 || matches_len == 0) return;
+
+    // Whatever could be redone goes
+    if (h->now < h->edits_len)
+    {
+        h->arena.len = h->edits[h->now].data;
+        h->deltas_len = h->edits[h->now].delta;
+        h->edits_len = h->now;
+    }
+
+    if (matches_len == 1 && history_coalesce(h, matches[0], with, with_len)) return;
+
+    size_t removed = 0;
+    for (size_t k = 0; k < matches_len; k++) removed += matches[k].len;
+
+    // Too big to ever fit, nothing before it can be undone either
+    size_t size = with_len + removed + matches_len * sizeof(*h->deltas) + sizeof(*h->edits);
+    if (size > h->cap)
+    {
+        history_free(h);
+        return;
+    }
+
+    if (history_memory(h) + size > h->cap) history_trim(h, h->cap - size);
+
+    if (h->edits_len >= h->edits_cap)
+    {
+        h->edits_cap = h->edits_cap == 0 ? 64 : h->edits_cap * 2;
+        h->edits = realloc(h->edits, h->edits_cap * sizeof(*h->edits));
+        assert(h->edits != NULL && "Failed to realloc history edits");
+    }
+
+    if (h->deltas_len + matches_len > h->deltas_cap)
+    {
+        if (h->deltas_cap == 0) h->deltas_cap = 64;
+        while (h->deltas_len + matches_len > h->deltas_cap) h->deltas_cap *= 2;
+
+        h->deltas = realloc(h->deltas, h->deltas_cap * sizeof(*h->deltas));
+        assert(h->deltas != NULL && "Failed to realloc history deltas");
+    }
+
+    h->edits[h->edits_len++] = (HistoryEdit){
+        .delta    = h->deltas_len,
+        .data     = h->arena.len,
+        .inserted = with_len,
+        .cursor   = cursor,
+        .step     = !h->grouped,
+    };
+
+    h->grouped = h->group;
+
+    size_t data = h->arena.len;
+    h->arena.len += with_len + removed;
+    string_check_capacity(&h->arena);
+
+    if (with_len > 0) memcpy(h->arena.data + data, with, with_len);
+    data += with_len;
+
+    for (size_t k = 0; k < matches_len; k++)
+    {
+        data += piece_table_read(text, matches[k].start, matches[k].len, h->arena.data + data);
+        h->deltas[h->deltas_len++] = (HistoryDelta){matches[k].start, matches[k].len};
+    }
+
+    h->now = h->edits_len;
+}
+
+// Edits from here until history_end_group are undone as one step
+void history_begin_group(History *h)
+{
+    h->group = 1;
+    h->grouped = 0;
+}
+
+void history_end_group(History *h)
+{
+    h->group = 0;
+    h->grouped = 0;
+}
+
+// Makes edit number `edit` again, or takes it back, as a single replace
+void history_apply(History *h, PieceTable *text, size_t edit, int undo)
+{
+    HistoryEdit *e = &h->edits[edit];
+    size_t n = history_deltas_end(h, edit) - e->delta;
+
+    Match *matches = malloc(n * sizeof(*matches));
+    assert(matches != NULL && "Failed to alloc history replace");
+
+    if (!undo)
+    {
+        for (size_t k = 0; k < n; k++)
+        {
+            HistoryDelta *d = &h->deltas[e->delta + k];
+            matches[k] = (Match){d->offset, d->removed};
+        }
+
+        piece_table_replace(text, matches, n, h->arena.data + e->data, e->inserted);
+        free(matches);
+        return;
+    }
+
+    Match *with = malloc(n * sizeof(*with));
+    assert(with != NULL && "Failed to alloc history replace");
+
+    // Once made, each delta is moved by the ones before it
+    size_t shift = 0;
+    size_t data = e->data + e->inserted;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        HistoryDelta *d = &h->deltas[e->delta + k];
+
+        matches[k] = (Match){d->offset + shift, e->inserted};
+        with[k] = (Match){data, d->removed};
+
+        shift += e->inserted - d->removed;
+        data += d->removed;
+    }
+
+    piece_table_replace_each(text, matches, n, h->arena.data, with);
+
+    free(with);
+    free(matches);
+}
+
+// Takes back the last step and puts `cursor` where it was before it. Returns
+// 0 when there is nothing to undo.
+int history_undo(History *h, PieceTable *text, size_t *cursor)
+{
+    if (h->now == 0) return 0;
+
+    history_end_group(h);
+
+    do
+    {
+        h->now -= 1;
+        history_apply(h, text, h->now, 1);
+    }
+    while (h->now > 0 && !h->edits[h->now].step);
+
+    *cursor = h->edits[h->now].cursor;
+    return 1;
+}
+
+// Makes the next undone step again and puts `cursor` at its start. Returns 0
+// when there is nothing to redo.
+int history_redo(History *h, PieceTable *text, size_t *cursor)
+{
+    if (h->now == h->edits_len) return 0;
+
+    history_end_group(h);
+    *cursor = h->deltas[h->edits[h->now].delta].offset;
+
+    do
+    {
+        history_apply(h, text, h->now, 0);
+        h->now += 1;
+    }
+    while (h->now < h->edits_len && !h->edits[h->now].step);
+
+    return 1;
+}
+
+// Steps that can be undone and redone from where it is
+void history_steps(History *h, size_t *undo, size_t *redo)
+{
+    *undo = 0;
+    *redo = 0;
+
+    for (size_t i = 0; i < h->edits_len; i++)
+    {
+        if (!h->edits[i].step && i > 0) continue;
+        if (i < h->now) *undo += 1;
+        else *redo += 1;
+    }
+}
+
+typedef struct {
+    const char *filepath;
+    PieceTable text;
+    Highlighter syntax;
+    WrapLayout wrap;
+    size_t index;
+    Vector2 scroll;
+    Loader *loader; // Not NULL while the file is still being read
+
+    int loaded;    // The text is in memory
+    int from_file; // The text can be read again from `filepath`
+    int unreadable; // The file is there but couldn't be read, saving would empty it
+    size_t clean_edit_count; // Edit count when the text last matched the file
+    size_t restore_index;    // Cursor to go back to once loaded that far
+    double last_viewed;
+
+    // Cursors besides `index`, sorted, none of them on the same byte as
+    // another or as `index`
+    size_t *cursors;
+    size_t cursors_len;
+    size_t cursors_cap;
+
+    History history;
+} Buffer;
+
+typedef struct {
+    MemoryUsage text;    // See piece_table_usage
+    MemoryUsage history;
+    MemoryUsage other;   // Syntax states, wrap layout and cursors
+    size_t mapped;       // Of the file, in the page cache and not the heap
+} BufferUsage;
+
+BufferUsage buffer_usage(Buffer *b)
+{
+    BufferUsage u = {0};
+
+    u.text = piece_table_usage(&b->text);
+    u.history = history_usage(&b->history);
+    u.other = highlighter_usage(&b->syntax);
+    MemoryUsage wrap = wrap_layout_usage(&b->wrap);
+    memory_usage_add(&u.other, wrap.used, wrap.reserved);
+    memory_usage_add(&u.other, b->cursors_len * sizeof(*b->cursors), b->cursors_cap * sizeof(*b->cursors));
+    u.mapped = b->text.original.len;
+
+    return u;
+}
+
+MemoryUsage buffer_usage_total(BufferUsage u)
+{
+    MemoryUsage m = u.text;
+    memory_usage_add(&m, u.history.used, u.history.reserved);
+    memory_usage_add(&m, u.other.used, u.other.reserved);
+    return m;
+}
+
+int buffer_modified(Buffer *b)
+{
+    return b->loaded && b->text.edit_count != b->clean_edit_count;
+}
+
+void buffer_empty(Buffer *b)
+{
+    piece_table_init(&b->text);
+    b->filepath = "untitled";
+    highlighter_init(&b->syntax, &b->text, b->filepath);
+    wrap_layout_init(&b->wrap, &b->text);
+    b->loaded = 1;
+}
+
+// Only the first chunk is read before returning, buffer_poll_loading brings
+// in the rest as the loader gets through it. A file that doesn't exist yet
+// gives an empty buffer; one that can't be read does too, but it is marked
+// `unreadable` and -1 is returned.
+int buffer_load_from_file(Buffer *b, const char *filepath)
+{
+    b->filepath = filepath;
+    b->from_file = 1;
+    b->loaded = 1;
+    highlighter_init(&b->syntax, &b->text, filepath);
+    b->wrap.text = &b->text;
+
+    // Reloading an evicted buffer, its edits go on from where they were
+    size_t edit_count = b->text.edit_count;
+
+    if (piece_table_map_file(&b->text, filepath) < 0)
+    {
+        b->unreadable = errno != ENOENT;
+        b->text.edit_count = edit_count;
+        b->clean_edit_count = edit_count;
+        return b->unreadable ? -1 : 0;
+    }
+
+    b->unreadable = 0;
+
+    const char *data = b->text.original.data;
+    size_t len = b->text.original.len;
+    size_t first = len < LOAD_CHUNK ? len : LOAD_CHUNK;
+
+    Offsets lines = {0};
+    offsets_push_newlines(&lines, data, 0, first);
+    piece_table_append_original(&b->text, 0, first, lines.data, lines.len);
+    free(lines.data);
+
+    if (edit_count > 0)
+    {
+        b->text.edit_count = edit_count;
+        piece_table_log_edit(&b->text, 0, 1);
+    }
+
+    b->clean_edit_count = b->text.edit_count;
+
+    if (first < len) b->loader = loader_start(data, len, first);
+    return 0;
+}
+
+// While the file is still loading, the end of the text is where the rest of
+// it goes. Bytes inserted there would land in the middle of the file, so
+// inserts at `idx` wait until it is all in.
+int buffer_loading_tail(Buffer *b, size_t idx)
+{
+    return b->loader != NULL && idx == b->text.len;
+}
+
+// Appends what the loader got through since the last call, returns 1 once
+// the whole file is in
+int buffer_poll_loading(Buffer *b)
+{
+    Loader *l = b->loader;
+    if (l == NULL) return 1;
+
+    // Appending the file doesn't count as a change to it
+    int clean = !buffer_modified(b);
+
+    pthread_mutex_lock(&l->lock);
+
+    size_t scanned = l->scanned;
+    piece_table_append_original(&b->text, l->taken, scanned - l->taken, l->lines.data, l->lines.len);
+    l->lines.len = 0;
+
+    pthread_mutex_unlock(&l->lock);
+
+    if (clean) b->clean_edit_count = b->text.edit_count;
+
+    if (b->restore_index != 0 && b->restore_index <= b->text.len)
+    {
+        b->index = b->restore_index;
+        b->restore_index = 0;
+    }
+
+    l->taken = scanned;
+    if (scanned < l->len) return 0;
+
+    loader_free(l);
+    b->loader = NULL;
+
+    return 1;
+}
+
+// Releases the text of an unmodified buffer, buffer_reload brings it back
+void buffer_unload(Buffer *b)
+{
+    assert(b->from_file && b->loader == NULL && !buffer_modified(b) && "Buffer can't be unloaded");
+
+    piece_table_free(&b->text);
+    highlighter_free(&b->syntax);
+    wrap_layout_free(&b->wrap);
+    history_free(&b->history);
+    b->loaded = 0;
+    b->cursors_len = 0;
+}
+
+// Loads an unloaded buffer again, putting the cursor back where it was as
+// soon as the text reaches it. Returns -1 when the file couldn't be read.
+int buffer_reload(Buffer *b)
+{
+    size_t index = b->index;
+    int ret = buffer_load_from_file(b, b->filepath);
+
+    if (index > b->text.len)
+    {
+        b->index = b->text.len;
+        if (b->loader != NULL) b->restore_index = index;
+    }
+
+    return ret;
+}
+
+void buffer_clear(Buffer *b)
+{
+    // The loader reads from the mapping that is about to go away
+    if (b->loader != NULL)
+    {
+        loader_free(b->loader);
+        b->loader = NULL;
+    }
+
+    piece_table_clear(&b->text);
+    history_free(&b->history);
+    b->index = 0;
+    b->scroll = (Vector2){0};
+    b->cursors_len = 0;
+}
+
+// Logs replacing the `len` bytes at `start` with `with` in the history,
+// before it happens
+void buffer_record(Buffer *b, size_t start, size_t len, const char *with, size_t with_len)
+{
+    Match match = {start, len};
+    history_record(&b->history, &b->text, &match, 1, with, with_len, b->index);
+}
+
+// Splices all of `data` in at the cursor as one edit, the cursor ends up
+// after it
+void buffer_insert_bytes(Buffer *b, const char *data, size_t len)
+{
+    if (len == 0 || buffer_loading_tail(b, b->index)) return;
+
+    buffer_record(b, b->index, 0, data, len);
+    piece_table_insert(&b->text, b->index, data, len);
+    b->index += len;
+}
+
+// Takes out the bytes from `start` up to `end` as one edit, a cursor past
+// them moves back with the text
+void buffer_delete_range(Buffer *b, size_t start, size_t end)
+{
+    if (end > b->text.len) end = b->text.len;
+    if (start >= end) return;
+
+    buffer_record(b, start, end - start, NULL, 0);
+    piece_table_delete(&b->text, start, end - start);
+
+    if (b->index >= end) b->index -= end - start;
+    else if (b->index > start) b->index = start;
+}
+
+// Replaces `dst` with the bytes from `start` up to `end`, a span at a time
+void buffer_copy_range(Buffer *b, size_t start, size_t end, String *dst)
+{
+    if (end > b->text.len) end = b->text.len;
+    dst->len = 0;
+
+    while (start < end)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(&b->text, start, &span_len);
+        if (span_len > end - start) span_len = end - start;
+
+        string_append(dst, span, span_len);
+        start += span_len;
+    }
+
+    string_shrink(dst);
+}
+
+// Replaces each of the `matches` with `with` as one edit, see
+// piece_table_replace
+size_t buffer_replace(Buffer *b, const Match *matches, size_t matches_len, const char *with, size_t with_len)
+{
+    history_record(&b->history, &b->text, matches, matches_len, with, with_len, b->index);
+    return piece_table_replace(&b->text, matches, matches_len, with, with_len);
+}
+
+// Returns 0 when there was nothing to undo
+int buffer_undo(Buffer *b)
+{
+    size_t cursor = b->index;
+    if (!history_undo(&b->history, &b->text, &cursor)) return 0;
+
+    b->index = cursor <= b->text.len ? cursor : b->text.len;
+    b->cursors_len = 0;
+    return 1;
+}
+
+// Returns 0 when there was nothing to redo
+int buffer_redo(Buffer *b)
+{
+    size_t cursor = b->index;
+    if (!history_redo(&b->history, &b->text, &cursor)) return 0;
+
+    b->index = cursor <= b->text.len ? cursor : b->text.len;
+    b->cursors_len = 0;
+    return 1;
+}
+
+size_t buffer_get_row(Buffer b)
+{
+    return piece_table_row_of(&b.text, b.index);
+}
+
+size_t buffer_get_col(Buffer b)
+{
+    size_t line_begin = piece_table_row_start(&b.text, buffer_get_row(b));
+
+    return piece_table_count_codepoints(&b.text, line_begin, b.index);
+}
+
+void buffer_insert(Buffer *b, char c)
+{
+    buffer_insert_bytes(b, &c, 1);
+}
+
+void buffer_delete(Buffer *b)
+{
+    if (b->index < 1) return;
+
+    size_t char_start = b->index - 1;
+
+    while (char_start > 0 && (piece_table_get(&b->text, char_start) & 0xC0) == 0x80)
+        char_start -= 1;
+
+    buffer_record(b, char_start, b->index - char_start, NULL, 0);
+    piece_table_delete(&b->text, char_start, b->index - char_start);
+
+    b->index = char_start;
+}
+
+void buffer_move_right(Buffer *b)
+{
+    if (b->index >= b->text.len) return;
+
+    b->index += 1;
+
+    // Properly skip UTF-8 bytes
+    while (b->index < b->text.len && (piece_table_get(&b->text, b->index) & 0xC0) == 0x80)
+        b->index += 1;
+}
+
+void buffer_move_left(Buffer *b)
+{
+    if (b->index < 1) return;
+
+    b->index -= 1;
+
+    // Properly skip UTF-8 bytes
+    while (b->index > 0 && (piece_table_get(&b->text, b->index) & 0xC0) == 0x80)
+        b->index -= 1;
+}
+
+size_t buffer_get_line_len(Buffer b, size_t pos)
+{
+    if (pos >= b.text.len) return 0;
+
+    size_t row = piece_table_row_of(&b.text, pos);
+    size_t line_begin = piece_table_row_start(&b.text, row);
+    size_t line_end = piece_table_row_start(&b.text, row + 1);
+
+    // Leave the newline out, the last row doesn't have one
+    if (row + 1 < piece_table_rows(&b.text)) line_end -= 1;
+
+    return line_end - line_begin;
+}
+
+// Puts the cursor on column `col` of `row`, or at its end if it's shorter
+void buffer_move_to_col(Buffer *b, size_t row, size_t col)
+{
+    size_t line_begin = piece_table_row_start(&b->text, row);
+    size_t line_end = piece_table_next_newline(&b->text, line_begin);
+
+    b->index = piece_table_skip_codepoints(&b->text, line_begin, line_end, col);
+}
+
+// With soft wrapping on both go by visual rows, a long row is gone through
+// one visual row at a time
+void buffer_move_down(Buffer *b)
+{
+    size_t row = buffer_get_row(*b);
+    size_t rows = wrap_layout_rows_of(&b->wrap, row);
+
+    if (row + 1 >= piece_table_rows(&b->text) && rows == 1) return;
+
+    size_t col = buffer_get_col(*b);
+    size_t vcol = col;
+    size_t sub = wrap_layout_sub_row(&b->wrap, row, col, &vcol);
+
+    if (sub + 1 < rows)
+    {
+        buffer_move_to_col(b, row, (sub + 1) * b->wrap.width + vcol);
+        return;
+    }
+
+    if (row + 1 >= piece_table_rows(&b->text)) return;
+
+    buffer_move_to_col(b, row + 1, vcol);
+}
+
+void buffer_move_up(Buffer *b)
+{
+    size_t row = buffer_get_row(*b);
+
+    if (row == 0 && wrap_layout_rows_of(&b->wrap, row) == 1) return;
+
+    size_t col = buffer_get_col(*b);
+    size_t vcol = col;
+    size_t sub = wrap_layout_sub_row(&b->wrap, row, col, &vcol);
+
+    if (sub > 0)
+    {
+        buffer_move_to_col(b, row, (sub - 1) * b->wrap.width + vcol);
+        return;
+    }
+
+    if (row == 0) return;
+
+    // Onto the last visual row of the one above
+    size_t last = wrap_layout_rows_of(&b->wrap, row - 1) - 1;
+    buffer_move_to_col(b, row - 1, last * b->wrap.width + vcol);
+}
+
+void buffer_move_line_begin(Buffer *b)
+{
+    b->index = piece_table_line_begin(&b->text, b->index);
+}
+
+void buffer_move_line_end(Buffer *b)
+{
+    b->index = piece_table_next_newline(&b->text, b->index);
+}
+
+void buffer_new_line_bellow(Buffer *b)
+{
+    size_t line_end = piece_table_next_newline(&b->text, b->index);
+    if (buffer_loading_tail(b, line_end)) return;
+
+    buffer_record(b, line_end, 0, "\n", 1);
+    piece_table_insert(&b->text, line_end, "\n", 1);
+    b->index = line_end+1;
+}
+
+void buffer_new_line_above(Buffer *b)
+{
+    size_t line_start = piece_table_line_begin(&b->text, b->index);
+    if (buffer_loading_tail(b, line_start)) return;
+
+    buffer_record(b, line_start, 0, "\n", 1);
+    piece_table_insert(&b->text, line_start, "\n", 1);
+    b->index = line_start;
+}
+
+void buffer_move_next_word(Buffer *b)
+{
+    if (b->index >= b->text.len) return;
+
+    size_t next_word = b->index;
+
+    // Cursor is on top of characters
+    while (next_word < b->text.len && !isspace(piece_table_get(&b->text, next_word)))
+    {
+        next_word += 1;
+    }
+
+    // Cursor reached empty line
+    if (
+        next_word < b->text.len &&
+        piece_table_get(&b->text, next_word) == '\n' && piece_table_get(&b->text, next_word+1) == '\n'
+    ) {
+        next_word += 1;
+        b->index = next_word;
+        return;
+    }
+
+    // Cursor is on top of whitespace
+    while (next_word < b->text.len && isspace(piece_table_get(&b->text, next_word)))
+    {
+        next_word += 1;
+    }
+
+    b->index = next_word;
+}
+
+void buffer_move_prev_word(Buffer *b)
+{
+    if (b->index < 1) return;
+
+    size_t prev_word = b->index;
+
+    // Cursor is on top of whitespace
+    while (prev_word > 0 && isspace(piece_table_get(&b->text, prev_word-1)))
+    {
+        if (
+            prev_word >= 2 &&
+            piece_table_get(&b->text, prev_word-1) == '\n' && isspace(piece_table_get(&b->text, prev_word-2))
+        ) {
+            b->index = prev_word-1;
+            return;
+        }
+        prev_word -= 1;
+    }
+
+    // Cursor is on top of characters
+    while (prev_word > 0 && !isspace(piece_table_get(&b->text, prev_word-1)))
+    {
+        prev_word -= 1;
+    }
+
+    b->index = prev_word;
+}
+
+// Multiple cursors: edits at all of them go through piece_table_replace as
+// one edit, with a range per cursor in text order, and the cursors shift by
+// what came and went before them in a single pass
+
+// Position of `index` among the other cursors
+size_t buffer_cursor_rank(Buffer *b)
+{
+    size_t lo = 0, hi = b->cursors_len;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->cursors[mid] < b->index) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+void buffer_add_cursor(Buffer *b, size_t idx)
+{
+    if (idx > b->text.len || idx == b->index) return;
+
+    size_t main = b->index;
+    b->index = idx;
+    size_t at = buffer_cursor_rank(b);
+    b->index = main;
+
+    if (at < b->cursors_len && b->cursors[at] == idx) return;
+
+    if (b->cursors_len >= b->cursors_cap)
+    {
+        b->cursors_cap = b->cursors_cap == 0 ? 64 : b->cursors_cap * 2;
+        b->cursors = realloc(b->cursors, b->cursors_cap * sizeof(*b->cursors));
+        assert(b->cursors != NULL && "Failed to realloc cursors");
+    }
+
+    memmove(b->cursors + at + 1, b->cursors + at, (b->cursors_len - at) * sizeof(*b->cursors));
+    b->cursors[at] = idx;
+    b->cursors_len += 1;
+}
+
+// Every cursor in text order, `index` included, into `all`
+void buffer_cursors_all(Buffer *b, size_t *all)
+{
+    all[0] = b->index;
+    if (b->cursors_len == 0) return;
+
+    size_t rank = buffer_cursor_rank(b);
+
+    memcpy(all, b->cursors, rank * sizeof(*all));
+    all[rank] = b->index;
+    memcpy(all + rank + 1, b->cursors + rank, (b->cursors_len - rank) * sizeof(*all));
+}
+
+// Takes the cursors back from `all` as left by an edit or a motion, merging
+// the ones that ended up together. `rank` is where `index` was.
+void buffer_cursors_set(Buffer *b, size_t *all, size_t rank)
+{
+    size_t n = b->cursors_len + 1;
+    b->index = all[rank];
+    b->cursors_len = 0;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        if (k == rank || all[k] == b->index) continue;
+        if (b->cursors_len > 0 && b->cursors[b->cursors_len - 1] == all[k]) continue;
+
+        b->cursors[b->cursors_len++] = all[k];
+    }
+}
+
+// Replaces `ranges[k]` with `data` for the k-th cursor in text order and
+// leaves that cursor right after it
+void buffer_cursors_edit(Buffer *b, Match *ranges, const char *data, size_t len)
+{
+    size_t n = b->cursors_len + 1;
+    size_t rank = buffer_cursor_rank(b);
+
+    buffer_replace(b, ranges, n, data, len);
+
+    size_t *all = malloc(n * sizeof(*all));
+    assert(all != NULL && "Failed to alloc cursors");
+
+    size_t removed = 0;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        all[k] = ranges[k].start - removed + k * len + len;
+        removed += ranges[k].len;
+    }
+
+    buffer_cursors_set(b, all, rank);
+    free(all);
+}
+
+// Inserts `data` at every cursor
+void buffer_cursors_insert(Buffer *b, const char *data, size_t len)
+{
+    if (b->cursors_len == 0)
+    {
+        buffer_insert_bytes(b, data, len);
+        return;
+    }
+
+    size_t n = b->cursors_len + 1;
+    size_t *all = malloc(n * sizeof(*all));
+    Match *ranges = malloc(n * sizeof(*ranges));
+    assert(all != NULL && ranges != NULL && "Failed to alloc cursor ranges");
+
+    buffer_cursors_all(b, all);
+    for (size_t k = 0; k < n; k++) ranges[k] = (Match){all[k], 0};
+
+    if (!buffer_loading_tail(b, all[n - 1])) buffer_cursors_edit(b, ranges, data, len);
+    free(ranges);
+    free(all);
+}
+
+// Deletes the character before every cursor
+void buffer_cursors_delete(Buffer *b)
+{
+    if (b->cursors_len == 0)
+    {
+        buffer_delete(b);
+        return;
+    }
+
+    size_t n = b->cursors_len + 1;
+    size_t *all = malloc(n * sizeof(*all));
+    Match *ranges = malloc(n * sizeof(*ranges));
+    assert(all != NULL && ranges != NULL && "Failed to alloc cursor ranges");
+
+    buffer_cursors_all(b, all);
+
+    for (size_t k = 0; k < n; k++)
+    {
+        size_t start = all[k];
+        if (start > 0) start -= 1;
+
+        while (start > 0 && (piece_table_get(&b->text, start) & 0xC0) == 0x80) start -= 1;
+
+        ranges[k] = (Match){start, all[k] - start};
+    }
+
+    buffer_cursors_edit(b, ranges, NULL, 0);
+    free(ranges);
+    free(all);
+}
+
+int cursor_compare(const void *a, const void *b)
+{
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Moves every cursor with `motion`. Cursors can pass each other, one held
+// back at the top of the text while another comes up next to it, so they
+// are sorted again after.
+void buffer_cursors_move(Buffer *b, void (*motion)(Buffer *b))
+{
+    motion(b);
+    if (b->cursors_len == 0) return;
+
+    size_t n = b->cursors_len + 1;
+    size_t *all = malloc(n * sizeof(*all));
+    assert(all != NULL && "Failed to alloc cursors");
+
+    size_t main = b->index;
+    all[0] = main;
+
+    for (size_t k = 0; k < b->cursors_len; k++)
+    {
+        b->index = b->cursors[k];
+        motion(b);
+        all[k + 1] = b->index;
+    }
+
+    qsort(all, n, sizeof(*all), cursor_compare);
+
+    b->index = main;
+    size_t rank = 0;
+    while (all[rank] != main) rank++;
+
+    buffer_cursors_set(b, all, rank);
+    free(all);
+}
+
+// Save pipeline: the spans of a buffer are snapshotted on the UI thread and a
+// worker writes them to a temp file next to the target, syncs it and renames
+// it over the target. The file on disk is always either all of the old or all
+// of the new contents, and editing goes on while the write runs.
+
+// The limit on Linux, for when the headers keep it hidden
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef enum {
+    SAVE_IDLE = 0,
+    SAVE_RUNNING,
+    SAVE_DONE,
+    SAVE_FAILED,
+} SaveState;
+
+typedef struct {
+    pthread_t thread;
+    atomic_int state;
+
+    PieceTable *text; // Pinned until the job is polled
+    size_t edit_count; // Of the text that gets written
+    char path[PATH_MAX];
+    struct iovec *iov;
+    size_t iov_len;
+    size_t iov_cap;
+    size_t bytes;
+    mode_t create_mode; // Of files that don't exist yet, 0666 less the umask
+
+    char error[PATH_MAX + 128];
+} SaveJob;
+
+// The umask can only be read by setting it, which is not safe once other
+// threads create files, so it is read once up front
+void save_job_init(SaveJob *job)
+{
+    *job = (SaveJob){0};
+
+    mode_t mask = umask(0);
+    umask(mask);
+    job->create_mode = 0666 & ~mask;
+}
+
+void save_job_push(SaveJob *job, const char *data, size_t len)
+{
+    if (job->iov_len >= job->iov_cap)
+    {
+        job->iov_cap = job->iov_cap == 0 ? 64 : job->iov_cap * 2;
+        job->iov = realloc(job->iov, job->iov_cap * sizeof(*job->iov));
+        assert(job->iov != NULL && "Failed to realloc save spans");
+    }
+
+    job->iov[job->iov_len++] = (struct iovec){(void*)data, len};
+    job->bytes += len;
+}
+
+int save_job_error(SaveJob *job, const char *what)
+{
+    snprintf(job->error, sizeof(job->error), "Tried to %s '%s': %s", what, job->path, strerror(errno));
+    return -1;
+}
+
+// Writes every span, IOV_MAX at a time, picking up after short writes
+int save_job_write(SaveJob *job, int fd)
+{
+    struct iovec *iov = job->iov;
+    size_t left = job->iov_len;
+
+    while (left > 0)
+    {
+        ssize_t written = writev(fd, iov, left < IOV_MAX ? (int)left : IOV_MAX);
+
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            if (written == 0) errno = EIO;
+            return -1;
+        }
+
+        while (left > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            left--;
+        }
+
+        if (left > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+int save_job_write_file(SaveJob *job)
+{
+    // Through a symlink it is the file it points to that gets replaced, with
+    // the temp file next to it so the rename stays in one directory
+    char target[PATH_MAX];
+    if (realpath(job->path, target) == NULL)
+    {
+        if (errno != ENOENT) return save_job_error(job, "resolve");
+        snprintf(target, sizeof(target), "%s", job->path);
+    }
+
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", target);
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) return save_job_error(job, "create a temp file for");
+
+    // Keep the permissions of the file being replaced, a new file gets what
+    // opening it would have given instead of the 0600 of mkstemp
+    struct stat st;
+    int exists = stat(target, &st) == 0;
+
+    if ((!exists && errno != ENOENT) || fchmod(fd, exists ? st.st_mode & 07777 : job->create_mode) < 0)
+    {
+        save_job_error(job, "set the permissions of");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (save_job_write(job, fd) < 0 || fsync(fd) < 0)
+    {
+        save_job_error(job, "write");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (close(fd) < 0 || rename(tmp_path, target) < 0)
+    {
+        save_job_error(job, "replace");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Sync the directory too, otherwise the rename itself may not survive
+    // a crash. Failing here leaves a complete file either way.
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s", target);
+
+    char *slash = strrchr(dir_path, '/');
+    if (slash == NULL) strcpy(dir_path, ".");
+    else if (slash == dir_path) slash[1] = '\0';
+    else slash[0] = '\0';
+
+    int dir = open(dir_path, O_RDONLY);
+    if (dir != -1)
+    {
+        fsync(dir);
+        close(dir);
+    }
+
+    return 0;
+}
+
+void *save_job_run(void *arg)
+{
+    SaveJob *job = arg;
+
+    int ret = save_job_write_file(job);
+    atomic_store(&job->state, ret < 0 ? SAVE_FAILED : SAVE_DONE);
+
+    return NULL;
+}
+
+// Returns 0 when a save is already running, -1 with `error` set on failure
+int save_job_start(SaveJob *job, PieceTable *text, const char *path)
+{
+    if (atomic_load(&job->state) != SAVE_IDLE) return 0;
+
+    size_t path_len = strlen(path);
+    if (path_len >= sizeof(job->path))
+    {
+        snprintf(job->error, sizeof(job->error), "Path is too long to save: '%s'", path);
+        return -1;
+    }
+    memcpy(job->path, path, path_len + 1);
+
+    job->iov_len = 0;
+    job->bytes = 0;
+
+    for (size_t idx = 0; idx < text->len;)
+    {
+        size_t span_len = 0;
+        const char *span = piece_table_span(text, idx, &span_len);
+
+        save_job_push(job, span, span_len);
+        idx += span_len;
+    }
+
+    if (text->len > 0 && piece_table_get(text, text->len - 1) != '\n') save_job_push(job, "\n", 1);
+
+    piece_table_pin(text);
+    job->text = text;
+    job->edit_count = text->edit_count;
+    atomic_store(&job->state, SAVE_RUNNING);
+
+    int ret = pthread_create(&job->thread, NULL, save_job_run, job);
+
+    if (ret != 0)
+    {
+        errno = ret;
+        save_job_error(job, "start saving");
+        piece_table_unpin(text);
+        atomic_store(&job->state, SAVE_IDLE);
+        return -1;
+    }
+
+    return 1;
+}
+
+// Returns SAVE_DONE or SAVE_FAILED once for every finished job, after which
+// another one can start. With `wait` set it blocks until a running job ends.
+SaveState save_job_poll(SaveJob *job, int wait)
+{
+    SaveState state = atomic_load(&job->state);
+    if (state == SAVE_IDLE || (state == SAVE_RUNNING && !wait)) return state;
+
+    pthread_join(job->thread, NULL);
+    state = atomic_load(&job->state);
+
+    piece_table_unpin(job->text);
+    job->text = NULL;
+
+    atomic_store(&job->state, SAVE_IDLE);
+    return state;
+}
+
+#endif // BUFFER_H
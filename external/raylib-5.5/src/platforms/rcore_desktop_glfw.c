@@ -1122,6 +1122,15 @@ const char *GetKeyName(int key)
     return glfwGetKeyName(key, glfwGetKeyScancode(key));
 }
 
+// Wait for input events up to timeout seconds (no limit if negative)
+// NOTE: Events are registered by the callbacks as they arrive, without the
+// per frame reset done by PollInputEvents()
+void WaitInputEvents(double timeout)
+{
+    if (timeout < 0) glfwWaitEvents();
+    else glfwWaitEventsTimeout(timeout);
+}
+
 // Register all input events
 void PollInputEvents(void)
 {
@@ -1083,6 +1083,7 @@ RLAPI int GetFPS(void);                                           // Get current
 RLAPI void SwapScreenBuffer(void);                                // Swap back buffer with front buffer (screen drawing)
 RLAPI void PollInputEvents(void);                                 // Register all input events
 RLAPI void WaitTime(double seconds);                              // Wait for some time (halt program execution)
+RLAPI void WaitInputEvents(double timeout);                       // Wait for input events up to timeout seconds (no limit if negative), registered as they arrive
 
 // Random values generation functions
 RLAPI void SetRandomSeed(unsigned int seed);                      // Set the seed for the random number generator
@@ -1753,6 +1753,17 @@ void WaitTime(double seconds)
 #endif
 }
 
+#if !defined(PLATFORM_DESKTOP_GLFW)
+// Wait for input events up to timeout seconds (no limit if negative)
+// NOTE: Platforms other than desktop GLFW can't block on their events here, they
+// sleep a short while instead and events are registered by the next PollInputEvents()
+void WaitInputEvents(double timeout)
+{
+    double slice = 0.005;
+    WaitTime(((timeout >= 0) && (timeout < slice))? timeout : slice);
+}
+#endif
+
 //----------------------------------------------------------------------------------
 // Module Functions Definition: Misc
 //----------------------------------------------------------------------------------
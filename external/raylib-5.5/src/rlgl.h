@@ -422,6 +422,13 @@ typedef struct rlRenderBatch {
     float currentDepth;         // Current depth value for next draw
 } rlRenderBatch;
 
+// Draw statistics, accumulated by rlDrawRenderBatch() until reset
+typedef struct rlDrawStats {
+    int batchCount;             // Number of render batches drawn (batches with no vertex data are not counted)
+    int drawCallCount;          // Number of draw calls issued to the GPU
+    int vertexCount;            // Number of vertices drawn
+} rlDrawStats;
+
 // OpenGL version
 typedef enum {
     RL_OPENGL_11 = 1,           // OpenGL 1.1
@@ -725,6 +732,8 @@ RLAPI void rlDrawRenderBatch(rlRenderBatch *batch);     // Draw render batch dat
 RLAPI void rlSetRenderBatchActive(rlRenderBatch *batch); // Set the active render batch for rlgl (NULL for default internal)
 RLAPI void rlDrawRenderBatchActive(void);               // Update and draw internal render batch
 RLAPI bool rlCheckRenderBatchLimit(int vCount);         // Check internal buffer overflow for a given number of vertex
+RLAPI rlDrawStats rlGetDrawStats(void);                 // Get draw statistics accumulated since last reset
+RLAPI void rlResetDrawStats(void);                      // Reset draw statistics
 
 RLAPI void rlSetTexture(unsigned int id);               // Set current texture for render batch and check buffers limits
 
@@ -1082,6 +1091,8 @@ typedef struct rlglData {
         int framebufferWidth;               // Current framebuffer width
         int framebufferHeight;              // Current framebuffer height
 
+        rlDrawStats drawStats;              // Draw statistics, accumulated until reset
+
     } State;            // Renderer state
     struct {
         bool vao;                           // VAO support (OpenGL ES2 could not support VAO extension) (GL_ARB_vertex_array_object)
@@ -3052,11 +3063,19 @@ void rlDrawRenderBatch(rlRenderBatch *batch)
             // NOTE: Batch system accumulates calls by texture0 changes, additional textures are enabled for all the draw calls
             glActiveTexture(GL_TEXTURE0);
 
+            if (RLGL.State.vertexCounter > 0) RLGL.State.drawStats.batchCount++;
+
             for (int i = 0, vertexOffset = 0; i < batch->drawCounter; i++)
             {
                 // Bind current draw call texture, activated as GL_TEXTURE0 and Bound to sampler2D texture0 by default
                 glBindTexture(GL_TEXTURE_2D, batch->draws[i].textureId);
 
+                if (batch->draws[i].vertexCount > 0)
+                {
+                    RLGL.State.drawStats.drawCallCount++;
+                    RLGL.State.drawStats.vertexCount += batch->draws[i].vertexCount;
+                }
+
                 if ((batch->draws[i].mode == RL_LINES) || (batch->draws[i].mode == RL_TRIANGLES)) glDrawArrays(batch->draws[i].mode, vertexOffset, batch->draws[i].vertexCount);
                 else
                 {
@@ -3144,6 +3163,26 @@ void rlDrawRenderBatchActive(void)
 #endif
 }
 
+// Get draw statistics accumulated since last reset
+rlDrawStats rlGetDrawStats(void)
+{
+    rlDrawStats stats = { 0 };
+
+#if defined(GRAPHICS_API_OPENGL_33) || defined(GRAPHICS_API_OPENGL_ES2)
+    stats = RLGL.State.drawStats;
+#endif
+
+    return stats;
+}
+
+// Reset draw statistics
+void rlResetDrawStats(void)
+{
+#if defined(GRAPHICS_API_OPENGL_33) || defined(GRAPHICS_API_OPENGL_ES2)
+    RLGL.State.drawStats = (rlDrawStats){ 0 };
+#endif
+}
+
 // Check internal buffer overflow for a given number of vertex
 // and force a rlRenderBatch draw call if required
 bool rlCheckRenderBatchLimit(int vCount)
@@ -115,11 +115,24 @@
 #ifndef MAX_TEXTSPLIT_COUNT
     #define MAX_TEXTSPLIT_COUNT                  128        // Maximum number of substrings to split: TextSplit()
 #endif
+#ifndef MAX_GLYPH_LOOKUPS
+    #define MAX_GLYPH_LOOKUPS                      8        // Maximum number of fonts with a glyph lookup table: GetGlyphIndex()
+#endif
 
 //----------------------------------------------------------------------------------
 // Types and Structures Definition
 //----------------------------------------------------------------------------------
-//...
+// Glyph index lookup table for a font, built on first use by GetGlyphIndex()
+// NOTE: Codepoints in the BMP are resolved with a direct array, higher planes with a hash table
+typedef struct GlyphLookup {
+    const GlyphInfo *glyphs;    // Glyphs array the table was built for (NULL if slot is free)
+    int glyphCount;             // Number of glyphs in the array
+    int fallbackIndex;          // Index of fallback glyph '?'
+    int *bmp;                   // Glyph index for every codepoint in [0, 0xffff], fallback already resolved
+    int *hashKeys;              // Codepoints out of the BMP, open addressing with linear probing
+    int *hashValues;            // Glyph index for every key, -1 if the slot is empty
+    int hashCapacity;           // Hash table size, power of two (0 if there are no codepoints out of the BMP)
+} GlyphLookup;
 
 //----------------------------------------------------------------------------------
 // Global variables
@@ -131,6 +144,8 @@ extern bool isGpuReady;
 static Font defaultFont = { 0 };
 #endif
 
+static GlyphLookup glyphLookups[MAX_GLYPH_LOOKUPS] = { 0 };    // Glyph lookup tables, one per font glyphs array
+
 //----------------------------------------------------------------------------------
 // Other Modules Functions Declaration (required by text)
 //----------------------------------------------------------------------------------
@@ -147,6 +162,9 @@ static GlyphInfo *LoadFontDataBDF(const unsigned char *fileData, int dataSize, i
 #endif
 static int textLineSpacing = 2;                 // Text vertical line spacing in pixels (between lines)
 
+static GlyphLookup *GetGlyphLookup(Font font);              // Get glyph lookup table for a font, build it if required
+static void UnloadGlyphLookup(const GlyphInfo *glyphs);     // Unload glyph lookup table built for a glyphs array
+
 #if defined(SUPPORT_DEFAULT_FONT)
 extern void LoadFontDefault(void);
 extern void UnloadFontDefault(void);
@@ -938,6 +956,8 @@ void UnloadFontData(GlyphInfo *glyphs, int glyphCount)
 {
     if (glyphs != NULL)
     {
+        UnloadGlyphLookup(glyphs);
+
         for (int i = 0; i < glyphCount; i++) UnloadImage(glyphs[i].image);
 
         RL_FREE(glyphs);
@@ -1336,27 +1356,59 @@ Vector2 MeasureTextEx(Font font, const char *text, float fontSize, float spacing
 
 // Get index position for a unicode character on font
 // NOTE: If codepoint is not found in the font it fallbacks to '?'
+// NOTE: Lookup is constant time through a table built the first time a font is queried,
+// fonts beyond MAX_GLYPH_LOOKUPS fallback to a linear scan over the glyphs
 int GetGlyphIndex(Font font, int codepoint)
 {
     int index = 0;
 
 #define SUPPORT_UNORDERED_CHARSET
 #if defined(SUPPORT_UNORDERED_CHARSET)
-    int fallbackIndex = 0;      // Get index of fallback glyph '?'
+    GlyphLookup *lookup = GetGlyphLookup(font);
 
-    // Look for character index in the unordered charset
-    for (int i = 0; i < font.glyphCount; i++)
+    if (lookup != NULL)
     {
-        if (font.glyphs[i].value == 63) fallbackIndex = i;
-
-        if (font.glyphs[i].value == codepoint)
+        if ((codepoint >= 0) && (codepoint <= 0xffff)) index = lookup->bmp[codepoint];
+        else
         {
-            index = i;
-            break;
+            index = lookup->fallbackIndex;
+
+            if (lookup->hashCapacity > 0)
+            {
+                unsigned int mask = (unsigned int)lookup->hashCapacity - 1;
+                unsigned int slot = ((unsigned int)codepoint*2654435761u) & mask;
+
+                while (lookup->hashValues[slot] != -1)
+                {
+                    if (lookup->hashKeys[slot] == codepoint)
+                    {
+                        index = lookup->hashValues[slot];
+                        break;
+                    }
+
+                    slot = (slot + 1) & mask;
+                }
+            }
         }
     }
+    else if (font.glyphs != NULL)
+    {
+        int fallbackIndex = 0;      // Get index of fallback glyph '?'
+
+        // Look for character index in the unordered charset
+        for (int i = 0; i < font.glyphCount; i++)
+        {
+            if (font.glyphs[i].value == 63) fallbackIndex = i;
 
-    if ((index == 0) && (font.glyphs[0].value != codepoint)) index = fallbackIndex;
+            if (font.glyphs[i].value == codepoint)
+            {
+                index = i;
+                break;
+            }
+        }
+
+        if ((index == 0) && (font.glyphs[0].value != codepoint)) index = fallbackIndex;
+    }
 #else
     index = codepoint - 32;
 #endif
@@ -2135,6 +2187,92 @@ int GetCodepointPrevious(const char *text, int *codepointSize)
 //----------------------------------------------------------------------------------
 // Module specific Functions Definition
 //----------------------------------------------------------------------------------
+// Get glyph lookup table for a font, build it if required
+// NOTE: Tables are identified by the glyphs array, returns NULL if all slots are in use
+static GlyphLookup *GetGlyphLookup(Font font)
+{
+    if ((font.glyphs == NULL) || (font.glyphCount <= 0)) return NULL;
+
+    GlyphLookup *freeSlot = NULL;
+
+    for (int i = 0; i < MAX_GLYPH_LOOKUPS; i++)
+    {
+        if ((glyphLookups[i].glyphs == font.glyphs) && (glyphLookups[i].glyphCount == font.glyphCount)) return &glyphLookups[i];
+        if ((glyphLookups[i].glyphs == NULL) && (freeSlot == NULL)) freeSlot = &glyphLookups[i];
+    }
+
+    // Drop any stale table built for the same glyphs array with a different glyph count
+    UnloadGlyphLookup(font.glyphs);
+
+    for (int i = 0; (i < MAX_GLYPH_LOOKUPS) && (freeSlot == NULL); i++)
+    {
+        if (glyphLookups[i].glyphs == NULL) freeSlot = &glyphLookups[i];
+    }
+
+    if (freeSlot == NULL) return NULL;
+
+    GlyphLookup lookup = { 0 };
+    lookup.glyphs = font.glyphs;
+    lookup.glyphCount = font.glyphCount;
+
+    // Fallback glyph is the last '?' on the font, or the first glyph if there is none
+    for (int i = 0; i < font.glyphCount; i++) if (font.glyphs[i].value == 63) lookup.fallbackIndex = i;
+
+    int outOfBmpCount = 0;
+    for (int i = 0; i < font.glyphCount; i++) if ((font.glyphs[i].value < 0) || (font.glyphs[i].value > 0xffff)) outOfBmpCount++;
+
+    lookup.bmp = (int *)RL_MALLOC(0x10000*sizeof(int));
+    for (int i = 0; i < 0x10000; i++) lookup.bmp[i] = lookup.fallbackIndex;
+
+    if (outOfBmpCount > 0)
+    {
+        lookup.hashCapacity = 16;
+        while (lookup.hashCapacity < outOfBmpCount*2) lookup.hashCapacity *= 2;
+
+        lookup.hashKeys = (int *)RL_MALLOC(lookup.hashCapacity*sizeof(int));
+        lookup.hashValues = (int *)RL_MALLOC(lookup.hashCapacity*sizeof(int));
+        for (int i = 0; i < lookup.hashCapacity; i++) lookup.hashValues[i] = -1;
+    }
+
+    // NOTE: Glyphs are registered backwards so the first one wins on repeated codepoints
+    for (int i = font.glyphCount - 1; i >= 0; i--)
+    {
+        int codepoint = font.glyphs[i].value;
+
+        if ((codepoint >= 0) && (codepoint <= 0xffff)) lookup.bmp[codepoint] = i;
+        else
+        {
+            unsigned int mask = (unsigned int)lookup.hashCapacity - 1;
+            unsigned int slot = ((unsigned int)codepoint*2654435761u) & mask;
+
+            while ((lookup.hashValues[slot] != -1) && (lookup.hashKeys[slot] != codepoint)) slot = (slot + 1) & mask;
+
+            lookup.hashKeys[slot] = codepoint;
+            lookup.hashValues[slot] = i;
+        }
+    }
+
+    *freeSlot = lookup;
+
+    return freeSlot;
+}
+
+// Unload glyph lookup table built for a glyphs array
+static void UnloadGlyphLookup(const GlyphInfo *glyphs)
+{
+    for (int i = 0; i < MAX_GLYPH_LOOKUPS; i++)
+    {
+        if ((glyphs != NULL) && (glyphLookups[i].glyphs == glyphs))
+        {
+            RL_FREE(glyphLookups[i].bmp);
+            RL_FREE(glyphLookups[i].hashKeys);
+            RL_FREE(glyphLookups[i].hashValues);
+
+            glyphLookups[i] = (GlyphLookup){ 0 };
+        }
+    }
+}
+
 #if defined(SUPPORT_FILEFORMAT_FNT) || defined(SUPPORT_FILEFORMAT_BDF)
 // Read a line from memory
 // REQUIRES: memcpy()
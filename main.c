@@ -1,16 +1,45 @@
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <ctype.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "scan.h"
+#include "pattern.h"
+#include "syntax.h"
+#include "buffer.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <external/stb_rect_pack.h>
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include <external/stb_truetype.h>
+#pragma GCC diagnostic pop
 
 #define FONT_SIZE 33
 #define TAB_SIZE 4
-#define CODEPOINT_LEN 250
-#define STRING_INIT_CAP (1024*4)
+#define GLYPH_ATLAS_INIT_SIZE 256
+#define GLYPH_ATLAS_MAX_SIZE 4096
+#define COMMAND_CAP 1024
+#define SUBSTITUTE_CHUNK (1024*1024)
 
 // Inspired by alabaster.nvim colorscheme
 // https://sr.ht/~p00f/alabaster.nvim/
@@ -25,6 +54,19 @@
 #define COLOR_FG     0x7a9a7aff
 #define COLOR_CURSOR 0x9ABB9Aff
 #define COLOR_CMD    0x101810ff
+#define COLOR_MATCH  0x2f4a2fff
+
+// Syntax colors, indexed by SyntaxKind
+const unsigned int syntax_colors[SYNTAX_KIND_COUNT] = {
+    [SYNTAX_TEXT]     = COLOR_FG,
+    [SYNTAX_KEYWORD]  = 0xb2cf9eff,
+    [SYNTAX_TYPE]     = 0x8db5a6ff,
+    [SYNTAX_STRING]   = 0xc2b77eff,
+    [SYNTAX_NUMBER]   = 0xc99a72ff,
+    [SYNTAX_COMMENT]  = 0x4b634bff,
+    [SYNTAX_PREPROC]  = 0x93b36bff,
+    [SYNTAX_VARIABLE] = 0x8db5a6ff,
+};
 
 #define KEY_SEMICOLON 47
 
@@ -34,650 +76,2946 @@
         abort(); \
     } while(0)
 
+// Rows and columns are the visual ones, a wrapped buffer never scrolls
+// sideways
+void buffer_update_scroll(Buffer *b, Vector2 font_size)
+{
+    size_t col = 0;
+    size_t row = wrap_layout_locate(&b->wrap, buffer_get_row(*b), buffer_get_col(*b), &col);
+
+    Vector2 cursor_pos = {
+        col * font_size.x,
+        row * font_size.y
+    };
+
+    if (cursor_pos.x < b->scroll.x)
+        b->scroll.x = cursor_pos.x;
+    else if (cursor_pos.x + font_size.x > b->scroll.x + GetScreenWidth())
+        b->scroll.x = cursor_pos.x + font_size.x - GetScreenWidth();
+
+    if (cursor_pos.y < b->scroll.y)
+        b->scroll.y = cursor_pos.y;
+    else if (cursor_pos.y + font_size.y > b->scroll.y + GetScreenHeight())
+        b->scroll.y = cursor_pos.y + font_size.y - GetScreenHeight();
+
+    if (b->wrap.width > 0) b->scroll.x = 0;
+}
+
+// Glyph cache: glyphs are rasterized with stb_truetype the first time they
+// are drawn and packed into an atlas texture that doubles in size when it
+// fills up. Past GLYPH_ATLAS_MAX_SIZE the whole atlas is flushed and refilled
+// with whatever gets drawn next, so memory follows the glyphs in use.
+
+typedef struct {
+    int codepoint;
+    Rectangle rec; // Region in the atlas, empty for blank glyphs
+    float offset_x;
+    float offset_y;
+    float advance;
+} CachedGlyph;
+
+typedef struct {
+    unsigned char *font_data;
+    stbtt_fontinfo info;
+    float scale;
+    float ascent;
+
+    CachedGlyph *glyphs;
+    size_t glyphs_len;
+    size_t glyphs_cap;
+
+    // Open addressing codepoint -> glyph index + 1, 0 marks an empty slot
+    size_t *slots;
+    size_t slots_cap;
+
+    Image atlas;
+    Texture2D texture;
+    stbrp_context packer;
+    stbrp_node *packer_nodes;
+
+    // Bumped whenever glyph rectangles move or the texture is replaced
+    unsigned generation;
+} GlyphCache;
+
+void glyph_cache_reset_packer(GlyphCache *gc)
+{
+    free(gc->packer_nodes);
+    gc->packer_nodes = calloc(gc->atlas.width, sizeof(*gc->packer_nodes));
+    assert(gc->packer_nodes != NULL && "Failed to alloc atlas packer");
+
+    stbrp_init_target(&gc->packer, gc->atlas.width, gc->atlas.height, gc->packer_nodes, gc->atlas.width);
+}
+
+void glyph_cache_new_atlas(GlyphCache *gc, int size)
+{
+    Image atlas = GenImageColor(size, size, BLANK);
+    ImageFormat(&atlas, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA);
+
+    UnloadImage(gc->atlas);
+    gc->atlas = atlas;
+}
+
+void glyph_cache_upload(GlyphCache *gc)
+{
+    if (gc->texture.id != 0) UnloadTexture(gc->texture);
+    gc->texture = LoadTextureFromImage(gc->atlas);
+}
+
+void glyph_cache_map(GlyphCache *gc, int codepoint, size_t index)
+{
+    if ((gc->glyphs_len + 1) * 2 > gc->slots_cap)
+    {
+        size_t *old_slots = gc->slots;
+        size_t old_cap = gc->slots_cap;
+
+        gc->slots_cap = old_cap == 0 ? 256 : old_cap * 2;
+        gc->slots = calloc(gc->slots_cap, sizeof(*gc->slots));
+        assert(gc->slots != NULL && "Failed to alloc glyph slots");
+
+        for (size_t i = 0; i < old_cap; i++)
+        {
+            if (old_slots[i] != 0)
+                glyph_cache_map(gc, gc->glyphs[old_slots[i] - 1].codepoint, old_slots[i] - 1);
+        }
+
+        free(old_slots);
+    }
+
+    size_t mask = gc->slots_cap - 1;
+    size_t slot = ((unsigned)codepoint * 2654435761u) & mask;
+
+    while (gc->slots[slot] != 0) slot = (slot + 1) & mask;
+
+    gc->slots[slot] = index + 1;
+}
+
+// Forgets every glyph, they get rasterized again as they are drawn
+void glyph_cache_flush(GlyphCache *gc)
+{
+    // Quads already batched still sample the old atlas
+    rlDrawRenderBatchActive();
+
+    gc->glyphs_len = 0;
+    if (gc->slots != NULL) memset(gc->slots, 0, gc->slots_cap * sizeof(*gc->slots));
+
+    glyph_cache_new_atlas(gc, gc->atlas.width);
+    glyph_cache_reset_packer(gc);
+    glyph_cache_upload(gc);
+
+    gc->generation += 1;
+}
+
+// Doubles the atlas keeping the glyphs where they are
+void glyph_cache_grow(GlyphCache *gc)
+{
+    rlDrawRenderBatchActive();
+
+    Image old_atlas = gc->atlas;
+    gc->atlas = (Image){0};
+    glyph_cache_new_atlas(gc, old_atlas.width * 2);
+
+    Rectangle old_rec = {0, 0, old_atlas.width, old_atlas.height};
+    ImageDraw(&gc->atlas, old_atlas, old_rec, old_rec, WHITE);
+
+    // The old atlas is the first thing packed, the empty skyline puts it at the origin
+    glyph_cache_reset_packer(gc);
+    stbrp_rect used = {.w = old_atlas.width, .h = old_atlas.height};
+    stbrp_pack_rects(&gc->packer, &used, 1);
+
+    UnloadImage(old_atlas);
+    glyph_cache_upload(gc);
+
+    gc->generation += 1;
+}
+
+// Packs a `w`x`h` region, growing or flushing the atlas when there is no room
+int glyph_cache_pack(GlyphCache *gc, int w, int h, Rectangle *rec)
+{
+    // One pixel of padding keeps neighbours from bleeding into each other
+    stbrp_rect r = {.w = w + 1, .h = h + 1};
+
+    while (!stbrp_pack_rects(&gc->packer, &r, 1))
+    {
+        if (gc->atlas.width < GLYPH_ATLAS_MAX_SIZE)
+        {
+            glyph_cache_grow(gc);
+        }
+        else if (gc->glyphs_len > 0)
+        {
+            glyph_cache_flush(gc);
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    *rec = (Rectangle){r.x, r.y, w, h};
+    return 1;
+}
+
+CachedGlyph glyph_cache_rasterize(GlyphCache *gc, int codepoint)
+{
+    CachedGlyph glyph = {.codepoint = codepoint};
+
+    // Codepoints missing from the font fallback to '?'
+    int index = stbtt_FindGlyphIndex(&gc->info, codepoint);
+    if (index == 0) index = stbtt_FindGlyphIndex(&gc->info, '?');
+
+    int advance = 0;
+    stbtt_GetGlyphHMetrics(&gc->info, index, &advance, NULL);
+    glyph.advance = (int)(advance * gc->scale);
+
+    int w = 0, h = 0, x = 0, y = 0;
+    unsigned char *bitmap = stbtt_GetGlyphBitmap(&gc->info, gc->scale, gc->scale, index, &w, &h, &x, &y);
+
+    glyph.offset_x = x;
+    glyph.offset_y = y + (int)gc->ascent;
+
+    if (bitmap != NULL && w > 0 && h > 0 && glyph_cache_pack(gc, w, h, &glyph.rec))
+    {
+        unsigned char *pixels = (unsigned char*)gc->atlas.data;
+        unsigned char *region = malloc(w * h * 2);
+        assert(region != NULL && "Failed to alloc glyph region");
+
+        for (int i = 0; i < w * h; i++)
+        {
+            region[i*2]     = 255;
+            region[i*2 + 1] = bitmap[i];
+        }
+
+        for (int row = 0; row < h; row++)
+        {
+            size_t dst = ((size_t)(glyph.rec.y + row) * gc->atlas.width + (size_t)glyph.rec.x) * 2;
+            memcpy(pixels + dst, region + row * w * 2, w * 2);
+        }
+
+        UpdateTextureRec(gc->texture, glyph.rec, region);
+        free(region);
+    }
+
+    stbtt_FreeBitmap(bitmap, NULL);
+
+    return glyph;
+}
+
+int glyph_cache_init(GlyphCache *gc, const char *font_path, int font_size)
+{
+    *gc = (GlyphCache){0};
+
+    int data_len = 0;
+    gc->font_data = LoadFileData(font_path, &data_len);
+    if (gc->font_data == NULL) return -1;
+
+    if (!stbtt_InitFont(&gc->info, gc->font_data, stbtt_GetFontOffsetForIndex(gc->font_data, 0)))
+    {
+        fprintf(stderr, "[ERROR] Tried to parse font '%s'\n", font_path);
+        UnloadFileData(gc->font_data);
+        gc->font_data = NULL;
+        return -1;
+    }
+
+    int ascent = 0;
+    stbtt_GetFontVMetrics(&gc->info, &ascent, NULL, NULL);
+
+    gc->scale = stbtt_ScaleForPixelHeight(&gc->info, font_size);
+    gc->ascent = ascent * gc->scale;
+
+    glyph_cache_new_atlas(gc, GLYPH_ATLAS_INIT_SIZE);
+    glyph_cache_reset_packer(gc);
+    glyph_cache_upload(gc);
+
+    return 1;
+}
+
+// The pointer is only valid until the next glyph gets cached
+CachedGlyph *glyph_cache_get(GlyphCache *gc, int codepoint)
+{
+    if (gc->slots_cap > 0)
+    {
+        size_t mask = gc->slots_cap - 1;
+        size_t slot = ((unsigned)codepoint * 2654435761u) & mask;
+
+        while (gc->slots[slot] != 0)
+        {
+            CachedGlyph *glyph = &gc->glyphs[gc->slots[slot] - 1];
+            if (glyph->codepoint == codepoint) return glyph;
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    CachedGlyph glyph = glyph_cache_rasterize(gc, codepoint);
+
+    if (gc->glyphs_len >= gc->glyphs_cap)
+    {
+        gc->glyphs_cap = gc->glyphs_cap == 0 ? 256 : gc->glyphs_cap * 2;
+
+        void *buf = realloc(gc->glyphs, gc->glyphs_cap * sizeof(*gc->glyphs));
+        assert(buf != NULL && "Failed to realloc glyphs");
+
+        gc->glyphs = (CachedGlyph*)buf;
+    }
+
+    glyph_cache_map(gc, codepoint, gc->glyphs_len);
+    gc->glyphs[gc->glyphs_len] = glyph;
+
+    return &gc->glyphs[gc->glyphs_len++];
+}
+
+void glyph_cache_draw(GlyphCache *gc, int codepoint, Vector2 position, Color tint)
+{
+    CachedGlyph *glyph = glyph_cache_get(gc, codepoint);
+    if (glyph->rec.width == 0) return;
+
+    Rectangle dst = {
+        position.x + glyph->offset_x,
+        position.y + glyph->offset_y,
+        glyph->rec.width,
+        glyph->rec.height
+    };
+
+    DrawTexturePro(gc->texture, glyph->rec, dst, (Vector2){0}, 0, tint);
+}
+
+// Line cache: the quads of every visible row are kept between frames and
+// only rebuilt when an edit touches the row, the cursor enters or leaves it,
+// it scrolls into view or the atlas changes. Each row goes to rlgl as one
+// contiguous run of quads under a single texture bind.
+
+typedef struct {
+    float x, y, w, h; // Relative to the start of the row
+    float u0, v0, u1, v1;
+    Color color;
+} GlyphQuad;
+
+typedef struct {
+    size_t row; // SIZE_MAX when the slot is empty
+    size_t first_col;
+    size_t last_col;
+    size_t cursor_col; // SIZE_MAX when the cursor is elsewhere
+    unsigned generation;
+
+    GlyphQuad *quads;
+    size_t quads_len;
+    size_t quads_cap;
+} CachedLine;
+
+typedef struct {
+    size_t lines_drawn;
+    size_t lines_built;
+    size_t quads;
+    double seconds; // Spent in draw_characters
+} RenderStats;
+
+typedef struct {
+    PieceTable *text;
+    size_t edit_count;
+
+    // Indexed by row modulo the number of slots
+    CachedLine *lines;
+    size_t lines_len;
+
+    // Scratch for the row being built: its visible bytes and their codepoints
+    char *bytes;
+    size_t bytes_cap;
+    int *codepoints;
+    size_t codepoints_cap;
+
+    RenderStats stats;
+} LineCache;
+
+void line_cache_invalidate(LineCache *cache)
+{
+    for (size_t i = 0; i < cache->lines_len; i++) cache->lines[i].row = SIZE_MAX;
+}
+
+void line_cache_invalidate_rows(LineCache *cache, RowRange rows)
+{
+    for (size_t i = 0; i < cache->lines_len; i++)
+    {
+        CachedLine *line = &cache->lines[i];
+        if (line->row >= rows.first && line->row <= rows.last) line->row = SIZE_MAX;
+    }
+}
+
+// Drops the rows edited since the last frame and makes room for `rows` rows
+void line_cache_prepare(LineCache *cache, PieceTable *text, size_t rows)
+{
+    if (cache->lines_len != rows)
+    {
+        for (size_t i = 0; i < cache->lines_len; i++) free(cache->lines[i].quads);
+        free(cache->lines);
+
+        cache->lines = calloc(rows, sizeof(*cache->lines));
+        assert(cache->lines != NULL && "Failed to alloc line cache");
+
+        cache->lines_len = rows;
+        line_cache_invalidate(cache);
+    }
+
+    RowRange edited = {0};
+
+    if (cache->text != text || !piece_table_edited_rows(text, cache->edit_count, &edited))
+    {
+        line_cache_invalidate(cache);
+    }
+    else
+    {
+        line_cache_invalidate_rows(cache, edited);
+    }
+
+    cache->text = text;
+    cache->edit_count = text->edit_count;
+}
+
+void cached_line_push(CachedLine *line, GlyphQuad quad)
+{
+    if (line->quads_len >= line->quads_cap)
+    {
+        line->quads_cap = line->quads_cap == 0 ? 128 : line->quads_cap * 2;
+
+        void *buf = realloc(line->quads, line->quads_cap * sizeof(*line->quads));
+        assert(buf != NULL && "Failed to realloc line quads");
+
+        line->quads = (GlyphQuad*)buf;
+    }
+
+    line->quads[line->quads_len++] = quad;
+}
+
+void cached_line_build(LineCache *cache, CachedLine *line, GlyphCache *font, PieceTable *text, Highlighter *hl, size_t first_col, size_t last_col, float cell_width)
+{
+    size_t line_begin = piece_table_row_start(text, line->row);
+    size_t line_end = piece_table_row_start(text, line->row + 1);
+
+    // Leave the newline out, the last row doesn't have one
+    if (line->row + 1 < piece_table_rows(text)) line_end -= 1;
+
+    // The visible part of the row is copied out and decoded in one go. Four
+    // bytes per cell covers every valid sequence, only cells that are
+    // malformed anyway can be cut short.
+    size_t cols = last_col - first_col;
+    size_t start = piece_table_skip_codepoints(text, line_begin, line_end, first_col);
+    size_t bytes_len = line_end - start;
+    if (bytes_len > cols * 4) bytes_len = cols * 4;
+
+    if (cache->bytes_cap < bytes_len)
+    {
+        cache->bytes_cap = bytes_len;
+        cache->bytes = realloc(cache->bytes, cache->bytes_cap);
+        assert(cache->bytes != NULL && "Failed to realloc line bytes");
+    }
+
+    if (cache->codepoints_cap < cols)
+    {
+        cache->codepoints_cap = cols;
+        cache->codepoints = realloc(cache->codepoints, cache->codepoints_cap * sizeof(*cache->codepoints));
+        assert(cache->codepoints != NULL && "Failed to realloc line codepoints");
+    }
+
+    bytes_len = piece_table_read(text, start, bytes_len, cache->bytes);
+    size_t count = scan_decode_utf8(cache->bytes, bytes_len, cache->codepoints, cols);
+
+    // Kinds are per byte of the whole row, a cell takes the kind of its lead
+    // byte. The decoder skips continuation bytes before the first lead byte.
+    size_t kinds_len = 0;
+    const unsigned char *kinds = hl != NULL ? highlighter_row(hl, line->row, &kinds_len) : NULL;
+    size_t lead = start - line_begin;
+
+    unsigned generation;
+
+    // Start over if the atlas gets flushed or grows halfway through the row
+    do {
+        generation = font->generation;
+        line->quads_len = 0;
+
+        size_t pos = lead;
+
+        for (size_t k = 0; k < count; k++)
+        {
+            size_t col = first_col + k;
+
+            unsigned int color = COLOR_FG;
+
+            if (kinds != NULL)
+            {
+                while (pos - lead < bytes_len && (cache->bytes[pos - lead] & 0xC0) == 0x80) pos++;
+                if (pos < kinds_len) color = syntax_colors[kinds[pos++]];
+            }
+
+            CachedGlyph *glyph = glyph_cache_get(font, cache->codepoints[k]);
+            if (glyph->rec.width == 0) continue;
+
+            float atlas_w = font->texture.width;
+            float atlas_h = font->texture.height;
+
+            GlyphQuad quad = {
+                .x = col * cell_width + glyph->offset_x,
+                .y = glyph->offset_y,
+                .w = glyph->rec.width,
+                .h = glyph->rec.height,
+                .u0 = glyph->rec.x / atlas_w,
+                .v0 = glyph->rec.y / atlas_h,
+                .u1 = (glyph->rec.x + glyph->rec.width) / atlas_w,
+                .v1 = (glyph->rec.y + glyph->rec.height) / atlas_h,
+                .color = col == line->cursor_col ? GetColor(COLOR_BG) : GetColor(color),
+            };
+
+            cached_line_push(line, quad);
+        }
+    } while (generation != font->generation);
+
+    line->first_col = first_col;
+    line->last_col = last_col;
+    line->generation = generation;
+}
+
+void cached_line_submit(CachedLine *line, Texture2D atlas, Vector2 position)
+{
+    if (line->quads_len == 0) return;
+
+    rlCheckRenderBatchLimit(line->quads_len * 4);
+
+    rlSetTexture(atlas.id);
+    rlBegin(RL_QUADS);
+    rlNormal3f(0, 0, 1);
+
+    for (size_t i = 0; i < line->quads_len; i++)
+    {
+        GlyphQuad *q = &line->quads[i];
+        float x = position.x + q->x;
+        float y = position.y + q->y;
+
+        rlColor4ub(q->color.r, q->color.g, q->color.b, q->color.a);
+
+        rlTexCoord2f(q->u0, q->v0);
+        rlVertex2f(x, y);
+
+        rlTexCoord2f(q->u0, q->v1);
+        rlVertex2f(x, y + q->h);
+
+        rlTexCoord2f(q->u1, q->v1);
+        rlVertex2f(x + q->w, y + q->h);
+
+        rlTexCoord2f(q->u1, q->v0);
+        rlVertex2f(x + q->w, y);
+    }
+
+    rlEnd();
+    rlSetTexture(0);
+}
+
+// Highlights the matches that cross `area`, meant to go under the text. A
+// match that wraps is one rectangle per visual row.
+void draw_matches(PieceTable *text, WrapLayout *wrap, Vector2 font_size, Vector2 scroll, Rectangle area, const Match *matches, size_t matches_len)
+{
+    for (size_t i = 0; i < matches_len; i++)
+    {
+        const Match *m = &matches[i];
+
+        size_t row = piece_table_row_of(text, m->start);
+        size_t line_begin = piece_table_row_start(text, row);
+        size_t col = piece_table_count_codepoints(text, line_begin, m->start);
+        size_t cols = piece_table_count_codepoints(text, m->start, m->start + m->len);
+
+        size_t vcol = 0;
+        size_t vrow = wrap_layout_locate(wrap, row, col, &vcol);
+
+        while (cols > 0)
+        {
+            size_t n = cols;
+            if (wrap->width > vcol && n > wrap->width - vcol) n = wrap->width - vcol;
+
+            Rectangle rect = {
+                vcol * font_size.x - scroll.x,
+                vrow * font_size.y - scroll.y,
+                n * font_size.x,
+                font_size.y
+            };
+
+            if (CheckCollisionRecs(rect, area)) DrawRectangleRec(rect, GetColor(COLOR_MATCH));
+
+            cols -= n;
+            vrow += 1;
+            vcol = 0;
+        }
+    }
+}
+
+// Only the rows and columns that land inside the screen are looked at, so the
+// cost of a frame depends on the window size and not on the size of the text.
+// Rows are further limited to the ones crossing `area`, columns are not so
+// the cached rows stay the same whatever part of the screen is drawn. Rows
+// here are visual rows, with wrapping on each one is the part of a row that
+// `wrap` puts on it and only that part is read.
+void draw_characters(LineCache *cache, GlyphCache *font, PieceTable *text, Highlighter *hl, WrapLayout *wrap, Vector2 origin, Vector2 font_size, Vector2 scroll, Vector2 cursor_pos, Rectangle area)
+{
+    float first_row = floorf((scroll.y - origin.y + area.y) / font_size.y);
+    float last_row  = ceilf((scroll.y - origin.y + area.y + area.height) / font_size.y);
+    float first_col = floorf((scroll.x - origin.x) / font_size.x);
+    float last_col  = ceilf((scroll.x - origin.x + GetScreenWidth()) / font_size.x);
+
+    if (first_row < 0) first_row = 0;
+    if (first_col < 0) first_col = 0;
+    if (last_row <= first_row || last_col <= first_col) return;
+
+    double start = GetTime();
+
+    // A partially scrolled screen shows one row more than fits, plus one
+    // extra slot so scrolling by a row doesn't evict a row still on screen
+    line_cache_prepare(cache, text, (size_t)ceilf(GetScreenHeight() / font_size.y) + 2);
+
+    size_t rows = piece_table_rows(text);
+    size_t sub = 0;
+    size_t row = wrap_layout_find(wrap, (size_t)first_row, &sub);
+
+    for (size_t visual = (size_t)first_row; visual < (size_t)last_row && row < rows; visual++)
+    {
+        size_t row_first_col = (size_t)first_col;
+        size_t row_last_col = (size_t)last_col;
+
+        // Quads stay where they would be on a single row, the row is drawn
+        // further left instead
+        if (wrap->width > 0)
+        {
+            row_first_col = sub * wrap->width;
+            row_last_col = row_first_col + wrap->width;
+        }
+
+        Vector2 row_pos = {
+            origin.x - scroll.x - (row_first_col - first_col) * font_size.x,
+            origin.y - scroll.y + visual * font_size.y
+        };
+
+        size_t cursor_col = SIZE_MAX;
+
+        if (fabsf(cursor_pos.y - row_pos.y) < 0.5f && cursor_pos.x >= row_pos.x)
+            cursor_col = (size_t)roundf((cursor_pos.x - row_pos.x) / font_size.x);
+
+        CachedLine *line = &cache->lines[visual % cache->lines_len];
+
+        if (
+            line->row != row ||
+            line->first_col != row_first_col || line->last_col != row_last_col ||
+            line->cursor_col != cursor_col || line->generation != font->generation
+        ) {
+            line->row = row;
+            line->cursor_col = cursor_col;
+            cached_line_build(cache, line, font, text, hl, row_first_col, row_last_col, font_size.x);
+            cache->stats.lines_built += 1;
+        }
+
+        cached_line_submit(line, font->texture, row_pos);
+
+        cache->stats.lines_drawn += 1;
+        cache->stats.quads += line->quads_len;
+
+        if (++sub >= wrap_layout_rows_of(wrap, row))
+        {
+            row += 1;
+            sub = 0;
+        }
+    }
+
+    cache->stats.seconds += GetTime() - start;
+}
+
+// Text layer: the buffer is painted into a render texture that is kept
+// between frames and only repainted where something changed: rows touched by
+// an edit, the cells the cursor left and entered, and the band a vertical
+// scroll uncovers. The rest of a scrolled frame is the previous texture
+// moved by the scroll delta. Presenting the layer is one textured quad.
+
+#define DAMAGE_CAP 16
+
+typedef struct {
+    RenderTexture2D front;
+    RenderTexture2D back;
+    LineCache lines;
+
+    // What the texture currently shows
+    PieceTable *text;
+    size_t edit_count;
+    size_t wrap_width;
+    size_t visual_rows; // Of the whole text, when wrapping
+    Vector2 scroll;
+    Rectangle cursor; // Zero width when hidden
+    size_t matches_version;
+
+    Rectangle damage[DAMAGE_CAP];
+    size_t damage_len;
+    int damage_all;
+
+    size_t repaints;
+} TextLayer;
+
+void text_layer_damage(TextLayer *layer, Rectangle area)
+{
+    if (area.width <= 0 || area.height <= 0) return;
+
+    if (layer->damage_len == DAMAGE_CAP)
+    {
+        layer->damage_all = 1;
+        return;
+    }
+
+    layer->damage[layer->damage_len++] = area;
+}
+
+// Moves the current contents by -dy and damages the band left uncovered
+void text_layer_scroll(TextLayer *layer, float dy)
+{
+    float width  = layer->front.texture.width;
+    float height = layer->front.texture.height;
+
+    if (fabsf(dy) >= height)
+    {
+        layer->damage_all = 1;
+        return;
+    }
+
+    // Render textures are stored upside down, hence the negative height
+    BeginTextureMode(layer->back);
+    DrawTextureRec(layer->front.texture, (Rectangle){0, 0, width, -height}, (Vector2){0, -dy}, WHITE);
+    EndTextureMode();
+
+    RenderTexture2D tmp = layer->front;
+    layer->front = layer->back;
+    layer->back = tmp;
+
+    if (dy > 0) text_layer_damage(layer, (Rectangle){0, height - dy, width, dy});
+    else        text_layer_damage(layer, (Rectangle){0, 0, width, -dy});
+
+    // The cursor as painted moved along with the rest
+    layer->cursor.y -= dy;
+}
+
+void text_layer_repaint(TextLayer *layer, GlyphCache *font, PieceTable *text, Highlighter *hl, WrapLayout *wrap, Vector2 font_size, Vector2 scroll, Rectangle cursor, const Match *matches, size_t matches_len)
+{
+    // Nothing is drawn under the cursor when it is hidden
+    Vector2 cursor_pos = {-INFINITY, -INFINITY};
+    if (cursor.width > 0) cursor_pos = (Vector2){cursor.x, cursor.y};
+
+    BeginTextureMode(layer->front);
+
+    // Keep the layer opaque, glyph edges would otherwise lower its alpha and
+    // blend with whatever is below when it gets copied or presented
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+
+    for (size_t i = 0; i < layer->damage_len; i++)
+    {
+        Rectangle area = layer->damage[i];
+
+        int x0 = (int)floorf(area.x);
+        int y0 = (int)floorf(area.y);
+        int x1 = (int)ceilf(area.x + area.width);
+        int y1 = (int)ceilf(area.y + area.height);
+        BeginScissorMode(x0, y0, x1 - x0, y1 - y0);
+
+        DrawRectangleRec(area, GetColor(COLOR_BG));
+        draw_matches(text, wrap, font_size, scroll, area, matches, matches_len);
+
+        if (cursor.width > 0 && CheckCollisionRecs(cursor, area))
+            DrawRectangleRec(cursor, GetColor(COLOR_CURSOR));
+
+        draw_characters(&layer->lines, font, text, hl, wrap, (Vector2){0}, font_size, scroll, cursor_pos, area);
+
+        EndScissorMode();
+    }
+
+    EndBlendMode();
+    EndTextureMode();
+
+    layer->repaints += layer->damage_len;
+}
+
+// Brings the texture up to date with the text, its colors, wrapping, scroll,
+// cursor and the highlighted matches, whose version changes whenever they do
+void text_layer_update(TextLayer *layer, GlyphCache *font, PieceTable *text, Highlighter *hl, WrapLayout *wrap, Vector2 font_size, Vector2 scroll, Rectangle cursor, const Match *matches, size_t matches_len, size_t matches_version)
+{
+    int width  = GetScreenWidth();
+    int height = GetScreenHeight();
+
+    if (layer->front.texture.width != width || layer->front.texture.height != height)
+    {
+        if (layer->front.id != 0) UnloadRenderTexture(layer->front);
+        if (layer->back.id != 0) UnloadRenderTexture(layer->back);
+
+        layer->front = LoadRenderTexture(width, height);
+        layer->back  = LoadRenderTexture(width, height);
+        assert(layer->front.id != 0 && layer->back.id != 0 && "Failed to create text layer");
+
+        layer->damage_all = 1;
+    }
+
+    RowRange edited = {0};
+
+    // Rows that got more or fewer visual rows moved the ones below them, and
+    // the scroll may have moved to keep the view on the same text when they
+    // were above it, so nothing can be reused
+    size_t visual_rows = wrap->width > 0 ? wrap_layout_visual_row(wrap, piece_table_rows(text)) : 0;
+
+    if (
+        layer->text != text || layer->scroll.x != scroll.x || layer->matches_version != matches_version ||
+        layer->wrap_width != wrap->width || layer->visual_rows != visual_rows ||
+        !piece_table_edited_rows(text, layer->edit_count, &edited)
+    ) {
+        layer->damage_all = 1;
+    }
+
+    if (!layer->damage_all && layer->scroll.y != scroll.y)
+        text_layer_scroll(layer, scroll.y - layer->scroll.y);
+
+    // Rows lexed again in a different state, their text is the same
+    RowRange recolored = hl->recolored;
+    hl->recolored = (RowRange){SIZE_MAX, 0};
+    line_cache_invalidate_rows(&layer->lines, recolored);
+
+    if (!layer->damage_all)
+    {
+        RowRange damaged[2] = {edited, recolored};
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (damaged[i].first > damaged[i].last) continue;
+
+            float y0 = wrap_layout_visual_row(wrap, damaged[i].first) * font_size.y - scroll.y;
+            float y1 = height;
+            if (damaged[i].last != SIZE_MAX) y1 = wrap_layout_visual_row(wrap, damaged[i].last + 1) * font_size.y - scroll.y;
+
+            if (y0 < 0) y0 = 0;
+            if (y1 > height) y1 = height;
+            text_layer_damage(layer, (Rectangle){0, y0, width, y1 - y0});
+        }
+
+        if (memcmp(&layer->cursor, &cursor, sizeof(cursor)) != 0)
+        {
+            text_layer_damage(layer, layer->cursor);
+            text_layer_damage(layer, cursor);
+        }
+    }
+
+    if (layer->damage_all)
+    {
+        layer->damage[0] = (Rectangle){0, 0, width, height};
+        layer->damage_len = 1;
+    }
+
+    if (layer->damage_len > 0) text_layer_repaint(layer, font, text, hl, wrap, font_size, scroll, cursor, matches, matches_len);
+
+    layer->text = text;
+    layer->edit_count = text->edit_count;
+    layer->wrap_width = wrap->width;
+    layer->visual_rows = wrap->width > 0 ? wrap_layout_visual_row(wrap, piece_table_rows(text)) : 0;
+    layer->scroll = scroll;
+    layer->cursor = cursor;
+    layer->matches_version = matches_version;
+    layer->damage_len = 0;
+    layer->damage_all = 0;
+}
+
+void text_layer_draw(TextLayer *layer)
+{
+    float width  = layer->front.texture.width;
+    float height = layer->front.texture.height;
+    DrawTextureRec(layer->front.texture, (Rectangle){0, 0, width, -height}, (Vector2){0}, WHITE);
+}
+
+// Search: a worker thread runs the pattern over snapshots of every buffer and
+// publishes matches a chunk at a time, so the first ones show up while the
+// rest of a large file is still being searched. Matches of each buffer are
+// kept sorted by position, which makes n/N a binary search.
+
+#define SEARCH_CHUNK (1024*1024)
+#define SEARCH_MATCH_CAP (1 << 22)
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t start; // Position of the span in the text
+} Span;
+
+typedef struct {
+    PieceTable *text;
+    size_t edit_count; // Edit the matches belong to
+    PieceTable *pinned; // Text the worker reads, unpinned once it is reaped
+
+    // A buffer that isn't in memory is searched straight from its file,
+    // mapped until the worker is reaped
+    const char *path;
+    FileMap map;
+
+    Span *spans;
+    size_t spans_len;
+    size_t spans_cap;
+    size_t len;
+
+    // Guarded by the search lock while the worker runs
+    Match *matches;
+    size_t matches_len;
+    size_t matches_cap;
+    size_t scanned;
+    int capped;
+} SearchTarget;
+
+typedef struct {
+    pthread_t thread;
+    int started;
+    atomic_int cancel;
+    atomic_int running;
+    pthread_mutex_t lock;
+
+    Pattern pattern;
+    int active;
+    size_t generation; // Bumped whenever the matches are dropped
+
+    // Only used by the worker, a new pattern can be compiled while a
+    // cancelled one is still winding down
+    Pattern run_pattern;
+    size_t run_generation;
+
+    // One per buffer, in the same order
+    SearchTarget *targets;
+    size_t targets_len;
+    size_t first; // Searched first, the buffer on screen
+    size_t unreadable; // Files that couldn't be mapped in the last resume
+
+    char *scratch; // Only used by the worker
+} Search;
+
+void search_target_push(SearchTarget *t, size_t start, size_t len)
+{
+    if (t->matches_len >= t->matches_cap)
+    {
+        t->matches_cap = t->matches_cap == 0 ? 64 : t->matches_cap * 2;
+        t->matches = realloc(t->matches, t->matches_cap * sizeof(*t->matches));
+        assert(t->matches != NULL && "Failed to realloc matches");
+    }
+
+    t->matches[t->matches_len++] = (Match){start, len};
+}
+
+void search_target_reset(SearchTarget *t, PieceTable *text)
+{
+    t->text = text;
+    t->path = NULL;
+    t->edit_count = text->edit_count;
+    t->matches_len = 0;
+    t->scanned = 0;
+    t->capped = 0;
+}
+
+// Its length is only known once mapped
+void search_target_reset_file(SearchTarget *t, const char *path)
+{
+    t->text = NULL;
+    t->path = path;
+    t->len = SIZE_MAX;
+    t->matches_len = 0;
+    t->scanned = 0;
+    t->capped = 0;
+}
+
+// Takes the spans the worker will read, the text stays pinned until the
+// worker is stopped
+void search_target_snapshot(SearchTarget *t)
+{
+    t->spans_len = 0;
+    t->len = t->text->len;
+
+    for (size_t idx = 0; idx < t->len;)
+    {
+        if (t->spans_len >= t->spans_cap)
+        {
+            t->spans_cap = t->spans_cap == 0 ? 64 : t->spans_cap * 2;
+            t->spans = realloc(t->spans, t->spans_cap * sizeof(*t->spans));
+            assert(t->spans != NULL && "Failed to realloc search spans");
+        }
+
+        size_t span_len = 0;
+        const char *span = piece_table_span(t->text, idx, &span_len);
+
+        t->spans[t->spans_len++] = (Span){span, span_len, idx};
+        idx += span_len;
+    }
+
+    piece_table_pin(t->text);
+    t->pinned = t->text;
+}
+
+// Maps the file of the target as its only span
+int search_target_map(SearchTarget *t)
+{
+    if (file_map_open(&t->map, t->path) < 0) return -1;
+
+    t->spans_len = 0;
+    t->len = t->map.len;
+
+    if (t->len > 0)
+    {
+        if (t->spans_cap == 0)
+        {
+            t->spans_cap = 64;
+            t->spans = realloc(t->spans, t->spans_cap * sizeof(*t->spans));
+            assert(t->spans != NULL && "Failed to realloc search spans");
+        }
+
+        t->spans[t->spans_len++] = (Span){t->map.data, t->map.len, 0};
+    }
+
+    return 0;
+}
+
+// Copies text[pos, pos+len) out of the snapshot
+void search_target_copy(SearchTarget *t, size_t pos, size_t len, char *dst)
+{
+    size_t lo = 0, hi = t->spans_len;
+
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->spans[mid].start <= pos) lo = mid;
+        else hi = mid;
+    }
+
+    for (size_t i = lo, copied = 0; copied < len; i++)
+    {
+        Span *span = &t->spans[i];
+        size_t offset = pos + copied - span->start;
+        size_t n = span->len - offset;
+        if (n > len - copied) n = len - copied;
+
+        memcpy(dst + copied, span->data + offset, n);
+        copied += n;
+    }
+}
+
+// Searches from `scanned` to the end, a chunk at a time. Matches never cross
+// a newline, so chunks end right after one and no match is cut in half; only
+// a line longer than a chunk gets cut, with some overlap for literals. Regex
+// matches on such a line are approximate: `^` and `$` hold only at its real
+// ends, but a match across the cut is missed.
+// Nothing is published once the search was cleared, the matches would belong
+// to the old pattern.
+void search_target_run(Search *search, SearchTarget *t)
+{
+    Pattern *pattern = &search->run_pattern;
+
+    pthread_mutex_lock(&search->lock);
+    size_t pos = t->scanned;
+    pthread_mutex_unlock(&search->lock);
+
+    while (pos < t->len && !atomic_load(&search->cancel))
+    {
+        size_t len = t->len - pos < 2 * SEARCH_CHUNK ? t->len - pos : 2 * SEARCH_CHUNK;
+        search_target_copy(t, pos, len, search->scratch);
+
+        size_t cut = len;
+        int cut_line = 0;
+
+        if (pos + len < t->len)
+        {
+            size_t nl = scan_next_newline(search->scratch + SEARCH_CHUNK, len - SEARCH_CHUNK);
+            if (nl < len - SEARCH_CHUNK) cut = SEARCH_CHUNK + nl + 1;
+            else cut_line = 1;
+        }
+
+        // The previous chunk may have been cut mid-line
+        char prev = '\n';
+        if (pos > 0) search_target_copy(t, pos - 1, 1, &prev);
+
+        PatternBounds bounds = 0;
+        if (prev == '\n') bounds |= PATTERN_LINE_START;
+        if (!cut_line) bounds |= PATTERN_LINE_END;
+
+        Match found[256];
+        size_t found_len = 0;
+        size_t from = 0;
+        size_t start = 0, match_len = 0;
+
+        pthread_mutex_lock(&search->lock);
+        size_t chunk_matches = t->matches_len;
+        pthread_mutex_unlock(&search->lock);
+
+        while (pattern_find(pattern, search->scratch, cut, from, bounds, &start, &match_len, &search->cancel))
+        {
+            found[found_len++] = (Match){pos + start, match_len};
+            from = start + match_len;
+
+            if (found_len == sizeof(found) / sizeof(*found))
+            {
+                pthread_mutex_lock(&search->lock);
+                int stale = search->generation != search->run_generation;
+                for (size_t i = 0; i < found_len && !t->capped && !stale; i++)
+                {
+                    search_target_push(t, found[i].start, found[i].len);
+                    t->capped = t->matches_len >= SEARCH_MATCH_CAP;
+                }
+                pthread_mutex_unlock(&search->lock);
+
+                found_len = 0;
+                if (t->capped || stale) break;
+            }
+        }
+
+        // Cancelled halfway through the chunk, it is searched again from the
+        // start so the matches already published go
+        if (atomic_load(&search->cancel))
+        {
+            pthread_mutex_lock(&search->lock);
+            if (search->generation == search->run_generation)
+            {
+                t->matches_len = chunk_matches;
+                t->capped = 0;
+            }
+            pthread_mutex_unlock(&search->lock);
+            break;
+        }
+
+        size_t next = pos + cut;
+        if (cut_line && !pattern->is_regex && pattern->literal_len <= cut)
+            next = pos + cut - (pattern->literal_len - 1);
+
+        pthread_mutex_lock(&search->lock);
+        if (search->generation != search->run_generation)
+        {
+            pthread_mutex_unlock(&search->lock);
+            break;
+        }
+        for (size_t i = 0; i < found_len && !t->capped; i++)
+        {
+            search_target_push(t, found[i].start, found[i].len);
+            t->capped = t->matches_len >= SEARCH_MATCH_CAP;
+        }
+        t->scanned = t->capped ? t->len : next;
+        pthread_mutex_unlock(&search->lock);
+
+        pos = t->scanned;
+    }
+}
+
+void *search_run(void *arg)
+{
+    Search *search = arg;
+
+    for (size_t k = 0; k < search->targets_len && !atomic_load(&search->cancel); k++)
+    {
+        SearchTarget *t = &search->targets[(search->first + k) % search->targets_len];
+        if (t->pinned != NULL || t->map.data != NULL) search_target_run(search, t);
+    }
+
+    atomic_store(&search->running, 0);
+    return NULL;
+}
+
+// Stops the worker and lets go of the snapshots, matches found so far stay.
+// Without `wait` a worker still running is only told to stop, it is reaped by
+// a later call once it is done; returns whether it was.
+int search_stop(Search *search, int wait)
+{
+    if (search->started)
+    {
+        atomic_store(&search->cancel, 1);
+        if (!wait && atomic_load(&search->running)) return 0;
+
+        pthread_join(search->thread, NULL);
+        search->started = 0;
+    }
+
+    for (size_t i = 0; i < search->targets_len; i++)
+    {
+        SearchTarget *t = &search->targets[i];
+        file_map_close(&t->map);
+
+        if (t->pinned != NULL)
+        {
+            piece_table_unpin(t->pinned);
+            t->pinned = NULL;
+        }
+    }
+
+    atomic_store(&search->running, 0);
+    return 1;
+}
+
+// Picks up where the last run stopped, starting over on the texts that
+// changed since. Where there is no text, the file at `paths` is searched if
+// there is one; otherwise the buffer is still loading and waits until it is
+// complete. Does nothing while a cancelled worker winds down, the next poll
+// tries again.
+void search_resume(Search *search, PieceTable **texts, const char **paths, size_t texts_len, size_t first)
+{
+    if (!search_stop(search, 0)) return;
+
+    if (search->targets_len < texts_len)
+    {
+        search->targets = realloc(search->targets, texts_len * sizeof(*search->targets));
+        assert(search->targets != NULL && "Failed to realloc search targets");
+
+        memset(search->targets + search->targets_len, 0, (texts_len - search->targets_len) * sizeof(*search->targets));
+        search->targets_len = texts_len;
+    }
+
+    int pending = 0;
+    search->unreadable = 0;
+
+    for (size_t i = 0; i < texts_len; i++)
+    {
+        SearchTarget *t = &search->targets[i];
+
+        if (texts[i] == NULL && paths[i] == NULL)
+        {
+            t->text = NULL;
+            t->path = NULL;
+            continue;
+        }
+
+        if (texts[i] == NULL)
+        {
+            if (t->text != NULL || t->path != paths[i]) search_target_reset_file(t, paths[i]);
+            if (t->scanned >= t->len) continue;
+
+            if (search_target_map(t) < 0)
+            {
+                search->unreadable += 1;
+                continue;
+            }
+
+            pending |= t->len > 0;
+            continue;
+        }
+
+        if (t->text != texts[i] || t->edit_count != texts[i]->edit_count) search_target_reset(t, texts[i]);
+        if (t->scanned >= texts[i]->len) continue;
+
+        search_target_snapshot(t);
+        pending = 1;
+    }
+
+    search->first = first;
+    if (!pending) return;
+
+    if (search->scratch == NULL)
+    {
+        search->scratch = malloc(2 * SEARCH_CHUNK);
+        assert(search->scratch != NULL && "Failed to alloc search scratch");
+    }
+
+    search->run_pattern = search->pattern;
+    search->run_generation = search->generation;
+
+    atomic_store(&search->cancel, 0);
+    atomic_store(&search->running, 1);
+
+    int ret = pthread_create(&search->thread, NULL, search_run, search);
+    assert(ret == 0 && "Failed to start search");
+    search->started = 1;
+}
+
+void search_init(Search *search)
+{
+    *search = (Search){0};
+    pthread_mutex_init(&search->lock, NULL);
+}
+
+// Drops every match, a new pattern has to be searched from scratch. A worker
+// still running is cancelled but not waited for, it stops publishing as soon
+// as it sees the generation change.
+void search_clear(Search *search)
+{
+    search_stop(search, 0);
+
+    pthread_mutex_lock(&search->lock);
+    search->generation += 1;
+
+    for (size_t i = 0; i < search->targets_len; i++)
+    {
+        search->targets[i].text = NULL;
+        search->targets[i].path = NULL;
+        search->targets[i].matches_len = 0;
+        search->targets[i].scanned = 0;
+        search->targets[i].capped = 0;
+    }
+    pthread_mutex_unlock(&search->lock);
+
+    search->active = 0;
+}
+
+// Matches of `text` that are up to date with it, NULL when there are none
+SearchTarget *search_target_of(Search *search, PieceTable *text)
+{
+    if (!search->active) return NULL;
+
+    for (size_t i = 0; i < search->targets_len; i++)
+    {
+        SearchTarget *t = &search->targets[i];
+        if (t->text == text) return t->edit_count == text->edit_count ? t : NULL;
+    }
+
+    return NULL;
+}
+
+// First match starting at or after `pos`, matches_len when there is none.
+// Needs the search lock while the worker runs.
+size_t search_target_lower_bound(SearchTarget *t, size_t pos)
+{
+    size_t lo = 0, hi = t->matches_len;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->matches[mid].start < pos) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+// Profiler: where the time of each frame goes. F2 shows the last frame and
+// the rolling p50/p99 of the work time on screen, `--trace file.csv` writes
+// one row per frame. EndDrawing also sleeps to the target FPS and waits for
+// input, so it is recorded but kept out of the work time. With `--low-latency`
+// frames that handled a keystroke also record the time from the key to the
+// end of EndDrawing.
+
+#define PROFILE_HISTORY 256
+
+typedef enum {
+    PROFILE_POLL = 0,    // Loading, saving and search results
+    PROFILE_INPUT,       // handle_*_mode
+    PROFILE_LAYOUT,      // editor_update_wrap, buffer_update_scroll and editor_update_cursor
+    PROFILE_RENDER,      // Everything drawn, draw_characters included
+    PROFILE_FLUSH,       // The last rlgl batch going to the GPU
+    PROFILE_END_DRAWING, // Swap, frame pacing and waiting for events
+    PROFILE_STAGE_COUNT,
+} ProfileStage;
+
+const char *profile_stage_names[PROFILE_STAGE_COUNT] = {
+    [PROFILE_POLL]        = "poll",
+    [PROFILE_INPUT]       = "input",
+    [PROFILE_LAYOUT]      = "layout",
+    [PROFILE_RENDER]      = "render",
+    [PROFILE_FLUSH]       = "flush",
+    [PROFILE_END_DRAWING] = "end_drawing",
+};
+
 typedef struct {
-    char  *data;
-    size_t len;
-    size_t cap;
-} String;
+    double stages[PROFILE_STAGE_COUNT];
+    double draw_characters;
+    double work; // Every stage but EndDrawing
+    size_t glyphs;
+    int batches;
+    int draw_calls;
+    int vertices;
+    size_t buffer_len;
+    double latency; // Keystroke to the end of EndDrawing, 0 without one
+} FrameProfile;
+
+typedef struct {
+    int visible;
+    FILE *trace;
+
+    double mark;
+    FrameProfile frame;
+
+    FrameProfile history[PROFILE_HISTORY];
+    size_t frames;
+
+    // Every keystroke latency so far, for the summary at exit
+    double *latencies;
+    size_t latencies_len;
+    size_t latencies_cap;
+
+    // Totals at the end of the last frame, frames record the difference
+    RenderStats render;
+    rlDrawStats draw;
+} Profiler;
+
+int profiler_open_trace(Profiler *p, const char *path)
+{
+    p->trace = fopen(path, "w");
+    if (p->trace == NULL) return -1;
+
+    fprintf(p->trace, "frame,time_s");
+    for (int i = 0; i < PROFILE_STAGE_COUNT; i++) fprintf(p->trace, ",%s_ms", profile_stage_names[i]);
+    fprintf(p->trace, ",draw_characters_ms,work_ms,glyphs,batches,draw_calls,vertices,buffer_bytes,latency_ms\n");
+
+    return 0;
+}
+
+void profiler_begin_frame(Profiler *p)
+{
+    p->frame = (FrameProfile){0};
+    p->mark = GetTime();
+}
+
+// Charges the time since the last mark to `stage`
+void profiler_mark(Profiler *p, ProfileStage stage)
+{
+    double now = GetTime();
+    p->frame.stages[stage] += now - p->mark;
+    p->mark = now;
+}
+
+void profiler_end_frame(Profiler *p, RenderStats render, size_t buffer_len)
+{
+    FrameProfile *f = &p->frame;
+    rlDrawStats draw = rlGetDrawStats();
+
+    for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+        if (i != PROFILE_END_DRAWING) f->work += f->stages[i];
+
+    f->draw_characters = render.seconds - p->render.seconds;
+    f->glyphs = render.quads - p->render.quads;
+    f->batches = draw.batchCount - p->draw.batchCount;
+    f->draw_calls = draw.drawCallCount - p->draw.drawCallCount;
+    f->vertices = draw.vertexCount - p->draw.vertexCount;
+    f->buffer_len = buffer_len;
+
+    p->render = render;
+    p->draw = draw;
+    p->history[p->frames % PROFILE_HISTORY] = *f;
+    p->frames += 1;
+
+    if (p->trace != NULL)
+    {
+        fprintf(p->trace, "%zu,%.6f", p->frames, GetTime());
+        for (int i = 0; i < PROFILE_STAGE_COUNT; i++) fprintf(p->trace, ",%.3f", f->stages[i] * 1000);
+        fprintf(
+            p->trace, ",%.3f,%.3f,%zu,%d,%d,%d,%zu,%.3f\n",
+            f->draw_characters * 1000, f->work * 1000, f->glyphs, f->batches, f->draw_calls, f->vertices,
+            f->buffer_len, f->latency * 1000
+        );
+    }
+}
+
+void profiler_add_latency(Profiler *p, double seconds)
+{
+    p->frame.latency = seconds;
+
+    if (p->latencies_len == p->latencies_cap)
+    {
+        p->latencies_cap = p->latencies_cap == 0 ? 1024 : p->latencies_cap * 2;
+        p->latencies = realloc(p->latencies, p->latencies_cap * sizeof(*p->latencies));
+        assert(p->latencies != NULL && "Failed to realloc latencies");
+    }
+
+    p->latencies[p->latencies_len++] = seconds;
+}
+
+int profile_compare(const void *a, const void *b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Work time percentile `q` over the frames in the history
+double profiler_percentile(Profiler *p, double q)
+{
+    size_t n = p->frames < PROFILE_HISTORY ? p->frames : PROFILE_HISTORY;
+    if (n == 0) return 0;
+
+    double works[PROFILE_HISTORY];
+    for (size_t i = 0; i < n; i++) works[i] = p->history[i].work;
+    qsort(works, n, sizeof(*works), profile_compare);
+
+    size_t k = (size_t)(q * (n - 1) + 0.5);
+    return works[k];
+}
+
+// Latency percentile `q` over the last `n` keystrokes
+double profiler_latency_percentile(Profiler *p, double q, size_t n)
+{
+    if (n > p->latencies_len) n = p->latencies_len;
+    if (n == 0) return 0;
+
+    double *sorted = malloc(n * sizeof(*sorted));
+    assert(sorted != NULL && "Failed to alloc latencies");
+
+    memcpy(sorted, p->latencies + p->latencies_len - n, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), profile_compare);
+
+    double latency = sorted[(size_t)(q * (n - 1) + 0.5)];
+    free(sorted);
+    return latency;
+}
+
+void profiler_print_latency(Profiler *p)
+{
+    size_t n = p->latencies_len;
+    if (n == 0) return;
+
+    printf(
+        "Keystroke to EndDrawing over %zu keystrokes: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+        n,
+        profiler_latency_percentile(p, 0.5, n) * 1e6,
+        profiler_latency_percentile(p, 0.9, n) * 1e6,
+        profiler_latency_percentile(p, 0.99, n) * 1e6,
+        profiler_latency_percentile(p, 1.0, n) * 1e6
+    );
+}
+
+// Lines of text in the top right corner, showing the last finished frame
+void profiler_draw(Profiler *p, GlyphCache *font, Vector2 font_size)
+{
+    if (!p->visible || p->frames == 0) return;
+
+    FrameProfile *f = &p->history[(p->frames - 1) % PROFILE_HISTORY];
+    char lines[5][128];
+
+    snprintf(
+        lines[0], sizeof(lines[0]), "work p50 %.2fms p99 %.2fms",
+        profiler_percentile(p, 0.5) * 1000, profiler_percentile(p, 0.99) * 1000
+    );
+    snprintf(
+        lines[1], sizeof(lines[1]), "in %.2f lay %.2f ren %.2f (chars %.2f)",
+        f->stages[PROFILE_INPUT] * 1000, f->stages[PROFILE_LAYOUT] * 1000, f->stages[PROFILE_RENDER] * 1000,
+        f->draw_characters * 1000
+    );
+    snprintf(
+        lines[2], sizeof(lines[2]), "flush %.2f end %.2f",
+        f->stages[PROFILE_FLUSH] * 1000, f->stages[PROFILE_END_DRAWING] * 1000
+    );
+    snprintf(
+        lines[3], sizeof(lines[3]), "%zu glyphs %d draws %zu bytes",
+        f->glyphs, f->draw_calls, f->buffer_len
+    );
+    snprintf(
+        lines[4], sizeof(lines[4]), "key p50 %.2fms p99 %.2fms",
+        profiler_latency_percentile(p, 0.5, PROFILE_HISTORY) * 1000,
+        profiler_latency_percentile(p, 0.99, PROFILE_HISTORY) * 1000
+    );
+
+    size_t width = 0;
+    for (int i = 0; i < 5; i++)
+        if (strlen(lines[i]) > width) width = strlen(lines[i]);
+
+    Rectangle bounds = {0};
+    bounds.width  = (width + 2) * font_size.x;
+    bounds.height = 5 * font_size.y;
+    bounds.x      = GetScreenWidth() - bounds.width;
+    bounds.y      = 0;
+
+    DrawRectangleRec(bounds, GetColor(COLOR_CMD));
+
+    for (int i = 0; i < 5; i++)
+    {
+        Vector2 position = {bounds.x + font_size.x, bounds.y + i * font_size.y};
+
+        for (const char *c = lines[i]; *c != '\0'; c++)
+        {
+            glyph_cache_draw(font, *c, position, GetColor(COLOR_FG));
+            position.x += font_size.x;
+        }
+    }
+}
+
+// Input: the keyboard as the mode handlers see it, one frame at a time. Live
+// frames come from raylib and can be recorded with `--record file`, and a
+// recording is fed back through the same handlers with `--replay file`.
+//
+// Recordings are text: a `file` line for each file on the command line, then
+// a `frame` line with the frame time and the time since start for every frame
+// where a key changed, was held or a character was typed, each followed by
+// the keys that went `down` and `up` and the `char`s typed in it.
+//
+// Held keys repeat from the time they went down rather than by counting
+// frames, so the rate is the same at any frame rate and in a replay.
+
+#define INPUT_KEY_CAP 512 // MAX_KEYBOARD_KEYS in raylib
+#define INPUT_CHAR_CAP 32
+
+#define INPUT_NO_WAIT 0.0
+#define INPUT_WAIT_FOREVER -1.0
+
+#define KEY_REPEAT_DELAY 0.2
+#define KEY_REPEAT_INTERVAL (1.0 / 75)
+
+typedef struct {
+    unsigned char down[INPUT_KEY_CAP];
+    unsigned char was_down[INPUT_KEY_CAP];
+
+    int chars[INPUT_CHAR_CAP];
+    size_t chars_len;
+    size_t chars_read;
+
+    float frame_time;
+    double time;
+    size_t events; // Keys that went down and characters typed this frame
+
+    // Earliest the input of this frame could have come in: when the wait for
+    // it ended, or the last poll when it was already there
+    double arrived;
+
+    double down_time[INPUT_KEY_CAP];
+    size_t repeats[INPUT_KEY_CAP];
+    int repeating; // A key held this frame, more repeats are coming
+
+    FILE *record;
+    FILE *replay;
+} Input;
+
+int input_pressed(Input *in, int key)
+{
+    return in->down[key] && !in->was_down[key];
+}
+
+int input_down(Input *in, int key)
+{
+    return in->down[key];
+}
+
+int input_released(Input *in, int key)
+{
+    return !in->down[key] && in->was_down[key];
+}
+
+// Times a held key acts this frame: once when it goes down, then every
+// KEY_REPEAT_INTERVAL once it has been held for KEY_REPEAT_DELAY
+int input_repeat(Input *in, int key)
+{
+    if (!in->down[key]) return 0;
+
+    in->repeating = 1;
+    if (input_pressed(in, key)) return 1;
+
+    double held = in->time - in->down_time[key] - KEY_REPEAT_DELAY;
+    if (held < 0) return 0;
+
+    size_t due = (size_t)(held / KEY_REPEAT_INTERVAL) + 1;
+    size_t repeats = due - in->repeats[key];
+    in->repeats[key] = due;
+
+    return (int)repeats;
+}
+
+// Next character typed this frame, 0 when there are no more
+int input_char(Input *in)
+{
+    return in->chars_read < in->chars_len ? in->chars[in->chars_read++] : 0;
+}
+
+void input_begin_frame(Input *in)
+{
+    memcpy(in->was_down, in->down, sizeof(in->down));
+    in->chars_len = 0;
+    in->chars_read = 0;
+    in->events = 0;
+    in->repeating = 0;
+}
+
+// Starts the repeats of the keys that went down this frame
+void input_press(Input *in, int key)
+{
+    in->down_time[key] = in->time;
+    in->repeats[key] = 0;
+}
+
+// Takes in what raylib has seen since the last call, returns whether any of
+// it is new this frame
+int input_sample(Input *in)
+{
+    int changed = 0;
+
+    for (int key = 0; key < INPUT_KEY_CAP; key++)
+    {
+        in->down[key] = IsKeyDown(key);
+        changed |= in->down[key] != in->was_down[key];
+    }
+
+    for (int c = GetCharPressed(); c > 0 && in->chars_len < INPUT_CHAR_CAP; c = GetCharPressed())
+        in->chars[in->chars_len++] = c;
+
+    return changed || in->chars_len > 0;
+}
+
+// Reads the keyboard from raylib, and writes the frame out when recording.
+// With nothing new, first waits up to `wait` seconds for something to come.
+void input_poll(Input *in, double wait)
+{
+    input_begin_frame(in);
+
+    double last = in->time;
+    int changed = input_sample(in);
+    in->arrived = last;
+
+    if (!changed && wait != INPUT_NO_WAIT)
+    {
+        WaitInputEvents(wait);
+
+        changed = input_sample(in);
+        in->arrived = GetTime();
+    }
+
+    in->frame_time = GetFrameTime();
+    in->time = GetTime();
+
+    int held = 0;
+
+    for (int key = 0; key < INPUT_KEY_CAP; key++)
+    {
+        held |= in->down[key];
+        if (!input_pressed(in, key)) continue;
+
+        input_press(in, key);
+        in->events += 1;
+    }
+
+    in->events += in->chars_len;
+
+    // Frames with a key held are kept too, key repeat adds up their time
+    if (in->record == NULL || !(changed || held || in->chars_len > 0)) return;
+
+    fprintf(in->record, "frame %.6f %.6f\n", in->frame_time, in->time);
+
+    for (int key = 0; key < INPUT_KEY_CAP; key++)
+    {
+        if (input_pressed(in, key)) fprintf(in->record, "down %d\n", key);
+        if (input_released(in, key)) fprintf(in->record, "up %d\n", key);
+    }
+
+    for (size_t i = 0; i < in->chars_len; i++) fprintf(in->record, "char %d\n", in->chars[i]);
+}
+
+// Takes the next frame of the recording, returns 0 once there are no more
+int input_read_frame(Input *in)
+{
+    input_begin_frame(in);
+
+    int in_frame = 0;
+    char line[256];
+
+    for (;;)
+    {
+        long pos = ftell(in->replay);
+        if (fgets(line, sizeof(line), in->replay) == NULL) return in_frame;
+
+        float frame_time = 0;
+        double time = 0;
+        int value = 0;
+
+        if (sscanf(line, "frame %f %lf", &frame_time, &time) == 2)
+        {
+            // Start of the next one, left for the next call
+            if (in_frame)
+            {
+                fseek(in->replay, pos, SEEK_SET);
+                return 1;
+            }
+
+            in_frame = 1;
+            in->frame_time = frame_time;
+            in->time = time;
+        }
+        else if (sscanf(line, "down %d", &value) == 1 && value >= 0 && value < INPUT_KEY_CAP)
+        {
+            in->down[value] = 1;
+            input_press(in, value);
+            in->events += 1;
+        }
+        else if (sscanf(line, "up %d", &value) == 1 && value >= 0 && value < INPUT_KEY_CAP)
+        {
+            in->down[value] = 0;
+        }
+        else if (sscanf(line, "char %d", &value) == 1 && in->chars_len < INPUT_CHAR_CAP)
+        {
+            in->chars[in->chars_len++] = value;
+            in->events += 1;
+        }
+    }
+}
+
+// Registers: the text yanks and deletes keep for puts. Every yank goes to
+// the unnamed register `"`, and to the one picked with a `"x` prefix before
+// it: `a` to `z`, or `+` for the system clipboard.
+
+#define REGISTER_COUNT 27
+
+typedef struct {
+    String text;
+    int linewise; // Put as whole lines, below or above the cursor's
+} Register;
+
+// NULL for the clipboard and anything that isn't a register
+Register *register_get(Register *registers, int name)
+{
+    if (name == 0 || name == '"') return &registers[0];
+    if (name >= 'a' && name <= 'z') return &registers[1 + name - 'a'];
+    return NULL;
+}
+
+typedef enum {
+    MODE_NORMAL = 0,
+    MODE_INSERT,
+    MODE_COMMAND,
+    MODE_SEARCH,
+} Mode;
+
+// Buffers with their text in memory, past this the ones viewed least
+// recently and not modified are unloaded
+#define BUFFER_RESIDENT_CAP 8
+#define STATUS_TIMEOUT 3.0
+
+typedef struct {
+    // Each buffer is allocated on its own so it stays put as the list grows,
+    // threads and caches hold on to their texts
+    Buffer **buffers;
+    size_t buffers_len;
+    size_t buffers_cap;
+    size_t active_buffer;
+
+    GlyphCache font;
+    TextLayer text_layer;
+    LineCache command_lines;
+    Vector2 font_size;
+    Rectangle command_bounds;
+    Buffer command_buffer;
+    int command_padding;
+    Mode mode;
+    Rectangle cursor;
+
+    SaveJob save;
+    Buffer *saving;
+
+    Search search;
+    char search_pattern[PATTERN_CAP];
+    size_t search_edit_count; // Of the command buffer when the search started
+    int search_reported;
+
+    // Matches on screen, copied out of the search every time they change
+    Match *visible_matches;
+    size_t visible_matches_len;
+    size_t visible_matches_cap;
+    size_t visible_matches_version;
+    size_t visible_key[5];
+
+    // Last message for the user, shown for STATUS_TIMEOUT seconds
+    char status[256];
+    double status_time;
+
+    Profiler profiler;
+    Input input;
+
+    Register registers[REGISTER_COUNT];
+    int register_name; // Picked with `"x` for the next yank or put, 0 for none
+    int pending;       // First character of a two character command
+
+    size_t history_cap; // Of each buffer's undo history
+    int wrap;           // Long rows are wrapped at the width of the window
+} Editor;
+
+// Everything but the font, which needs the window
+void editor_init(Editor *edt)
+{
+    Buffer cmd = {0};
+    buffer_empty(&cmd);
+    edt->command_buffer = cmd;
+
+    edt->mode = MODE_NORMAL;
+    edt->history_cap = HISTORY_CAP;
+
+    save_job_init(&edt->save);
+    search_init(&edt->search);
+}
 
-void string_check_capacity(String *s)
+void editor_load_font(Editor *edt)
 {
-    if (s->len >= s->cap)
-    {
-        if (s->cap == 0) s->cap = STRING_INIT_CAP;
+    const char *font_path = "resources/DepartureMono/DepartureMono-Regular.otf";
+    int ret = glyph_cache_init(&edt->font, font_path, FONT_SIZE);
+    assert(ret > 0 && "Failed to load font");
 
-        while (s->len >= s->cap) s->cap *= 2;
+    edt->font_size = (Vector2){glyph_cache_get(&edt->font, 'X')->advance, FONT_SIZE};
+    edt->command_padding = (int)edt->font_size.x / 1.5;
 
-        void *buf = realloc(s->data, s->cap * sizeof(*s->data));
-        assert(buf != NULL && "Failed to realloc string");
+    edt->cursor.width = edt->font_size.x;
+    edt->cursor.height = edt->font_size.y;
+}
 
-        s->data = (char*)buf;
+Buffer *editor_push_buffer(Editor *edt)
+{
+    if (edt->buffers_len >= edt->buffers_cap)
+    {
+        edt->buffers_cap = edt->buffers_cap == 0 ? 16 : edt->buffers_cap * 2;
+        edt->buffers = realloc(edt->buffers, edt->buffers_cap * sizeof(*edt->buffers));
+        assert(edt->buffers != NULL && "Failed to realloc buffer list");
     }
+
+    Buffer *buf = calloc(1, sizeof(*buf));
+    assert(buf != NULL && "Failed to alloc buffer");
+    buf->history.cap = edt->history_cap;
+
+    edt->buffers[edt->buffers_len++] = buf;
+    return buf;
 }
 
-void string_init(String *s)
+void editor_new_buffer(Editor *edt)
 {
-    string_check_capacity(s);
-    memset(s->data, 0, sizeof(char)*s->cap);
-    s->len = 0;
+    buffer_empty(editor_push_buffer(edt));
 }
 
-int string_from_file(String *s, const char *file_path)
+void editor_load_file(Editor *edt, const char *file_path)
 {
-    string_init(s);
+    buffer_load_from_file(editor_push_buffer(edt), file_path);
+}
 
-    FILE *file = fopen(file_path, "rb");
+// Lists a file without reading it, that happens when it is first shown
+void editor_add_file(Editor *edt, const char *file_path)
+{
+    Buffer *buf = editor_push_buffer(edt);
+    piece_table_init(&buf->text);
+    highlighter_init(&buf->syntax, &buf->text, file_path);
+    wrap_layout_init(&buf->wrap, &buf->text);
+    buf->filepath = file_path;
+    buf->from_file = 1;
+}
 
-    if (!file) {
-        fprintf(stderr, "[ERROR] Tried to open '%s': %s\n", file_path, strerror(errno));
-        return -1;
-    }
+void editor_set_status(Editor *edt, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(edt->status, sizeof(edt->status), fmt, args);
+    va_end(args);
 
-    int ret = fseek(file, 0L, SEEK_END);
+    edt->status_time = GetTime();
+}
 
-    if (ret == -1) {
-        fprintf(stderr, "[ERROR] Tried to seek to end of '%s': %s\n", file_path, strerror(errno));
-        fclose(file);
-        return -1;
-    }
+int editor_status_visible(Editor *edt)
+{
+    return edt->status[0] != '\0' && GetTime() - edt->status_time < STATUS_TIMEOUT;
+}
 
-    long int file_len = ftell(file);
+void editor_activate_buffer(Editor *edt, size_t index)
+{
+    edt->active_buffer = index;
 
-    if (file_len == -1) {
-        fprintf(stderr, "[ERROR] Tried to obtain position of '%s': %s\n", file_path, strerror(errno));
-        fclose(file);
-        return -1;
-    }
+    Buffer *buf = edt->buffers[index];
+    if (!buf->loaded && buffer_reload(buf) < 0) editor_set_status(edt, "Couldn't read '%s'", buf->filepath);
+}
 
-    rewind(file);
+// Unloads the buffers viewed least recently until at most BUFFER_RESIDENT_CAP
+// are loaded. Only buffers that can be read back as they are qualify: not on
+// screen, not modified, not loading and not in use by a save or a search.
+void editor_evict_buffers(Editor *edt)
+{
+    size_t loaded = 0;
+    for (size_t i = 0; i < edt->buffers_len; i++) loaded += edt->buffers[i]->loaded;
 
-    s->len = (size_t)file_len;
-    string_check_capacity(s);
+    while (loaded > BUFFER_RESIDENT_CAP)
+    {
+        Buffer *victim = NULL;
 
-    size_t buffer_len = fread(s->data, sizeof(char), (size_t)file_len ,file);
+        for (size_t i = 0; i < edt->buffers_len; i++)
+        {
+            Buffer *buf = edt->buffers[i];
 
-    if (ferror(file)) {
-        fprintf(stderr, "[ERROR] Tried to read '%s': %s\n", file_path, strerror(errno));
-        fclose(file);
-        return -1;
-    }
+            if (
+                i == edt->active_buffer || !buf->loaded || !buf->from_file || buf->loader != NULL ||
+                buf->text.pins > 0 || buffer_modified(buf)
+            ) {
+                continue;
+            }
 
-    s->data[buffer_len] = '\0';
-    s->len = buffer_len;
+            if (victim == NULL || buf->last_viewed < victim->last_viewed) victim = buf;
+        }
 
-    fclose(file);
+        if (victim == NULL) break;
 
-    return 1;
+        buffer_unload(victim);
+        loaded -= 1;
+    }
 }
 
-void string_clear(String *s)
+// Starts writing the active buffer in the background, editor_poll_save
+// reports back when it is done
+void editor_save_file(Editor *edt)
 {
-    memset(s->data, 0, s->cap);
-    s->len = 0;
-}
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-void string_insert(String *s, size_t idx, char c)
-{
-    if (idx <= s->len)
+    // Replays run on the user's files, they are only read
+    if (edt->input.replay != NULL)
     {
-        s->len += 1;
-        string_check_capacity(s);
+        editor_set_status(edt, "Not saving '%s' in a replay", buf->filepath);
+        return;
+    }
 
-        memmove(s->data + idx + 1, s->data + idx, s->len - idx - 1);
+    // Whatever isn't loaded yet would be missing from the file
+    if (buf->loader != NULL)
+    {
+        editor_set_status(edt, "Still loading '%s'", buf->filepath);
+        return;
+    }
 
-        s->data[idx] = c;
-        s->data[s->len] = '\0';
+    // The empty text stands in for a file that is still there
+    if (buf->unreadable)
+    {
+        editor_set_status(edt, "Couldn't read '%s', not saving over it", buf->filepath);
+        return;
     }
-}
 
-void string_delete(String *s, size_t idx)
-{
-    if (idx > 0)
+    int ret = save_job_start(&edt->save, &buf->text, buf->filepath);
+    if (ret > 0) edt->saving = buf;
+
+    if (ret == 0)
+    {
+        editor_set_status(edt, "Still saving '%s'", edt->save.path);
+    }
+    else if (ret < 0)
     {
-        memmove(s->data + idx - 1, s->data + idx, s->len - idx + 1);
-        s->len -= 1;
-        s->data[s->len] = '\0';
+        fprintf(stderr, "[ERROR] %s\n", edt->save.error);
+        editor_set_status(edt, "%s", edt->save.error);
     }
 }
 
-void string_info(String *s)
+void editor_poll_save(Editor *edt, int wait)
 {
-    printf("len = %lu\n", s->len);
-    printf("cap = %lu\n", s->cap);
-}
-
-typedef struct {
-    const char *filepath;
-    String text;
-    size_t index;
-    Vector2 scroll;
-} Buffer;
+    SaveState state = save_job_poll(&edt->save, wait);
 
-void buffer_empty(Buffer *b)
-{
-    String s = {0};
-    string_init(&s);
-    b->filepath = "untitled";
-    b->text = s;
+    if (state == SAVE_DONE)
+    {
+        // The file now holds the text as it was when the save started
+        edt->saving->clean_edit_count = edt->save.edit_count;
+        edt->saving = NULL;
+        printf("File '%s' was saved\n", edt->save.path);
+        editor_set_status(edt, "Saved '%s', %zu bytes", edt->save.path, edt->save.bytes);
+    }
+    else if (state == SAVE_FAILED)
+    {
+        edt->saving = NULL;
+        fprintf(stderr, "[ERROR] %s\n", edt->save.error);
+        editor_set_status(edt, "%s", edt->save.error);
+    }
 }
 
-void buffer_load_from_file(Buffer *b, const char *filepath)
+void editor_poll_loading(Editor *edt)
 {
-    String s = {0};
-    // FIXME: Check for errors
-    string_from_file(&s, filepath);
-    b->filepath = filepath;
-    b->text = s;
-}
+    for (size_t i = 0; i < edt->buffers_len; i++)
+    {
+        Buffer *buf = edt->buffers[i];
+        if (buf->loader == NULL) continue;
 
-void buffer_clear(Buffer *b)
-{
-    string_clear(&b->text);
-    b->index = 0;
-    b->scroll = (Vector2){0};
+        if (buffer_poll_loading(buf))
+        {
+            editor_set_status(edt, "Loaded '%s', %zu lines", buf->filepath, piece_table_rows(&buf->text));
+        }
+        else
+        {
+            int percent = (int)(100.0 * buf->loader->taken / buf->loader->len);
+            editor_set_status(edt, "Loading '%s' %d%%", buf->filepath, percent);
+        }
+    }
 }
 
-size_t buffer_get_col(Buffer b)
+// Texts of every buffer for the search, NULL for the ones still loading.
+// Buffers that aren't in memory, listed but never opened or evicted since,
+// are searched from their file, which holds what they would load.
+void editor_search_resume(Editor *edt)
 {
-    size_t col = 0;
+    PieceTable **texts = malloc(edt->buffers_len * sizeof(*texts));
+    const char **paths = malloc(edt->buffers_len * sizeof(*paths));
+    assert(texts != NULL && paths != NULL && "Failed to alloc search texts");
 
-    for (size_t i = 0; i < b.index; i++)
+    for (size_t i = 0; i < edt->buffers_len; i++)
     {
-        if ((b.text.data[i] & 0xC0) != 0x80) col += 1; // Skipping utf-8 cotinuation bytes
-        if (b.text.data[i] == '\n') col = 0;
+        Buffer *buf = edt->buffers[i];
+        texts[i] = buf->loaded && buf->loader == NULL ? &buf->text : NULL;
+        paths[i] = !buf->loaded && buf->from_file ? buf->filepath : NULL;
     }
 
-    return col;
+    search_resume(&edt->search, texts, paths, edt->buffers_len, edt->active_buffer);
+    free(paths);
+    free(texts);
 }
 
-size_t buffer_get_row(Buffer b)
+// Searches for whatever is in the command buffer, from scratch
+void editor_search_start(Editor *edt)
 {
-    size_t row = 0;
+    search_clear(&edt->search);
+    edt->search_reported = 0;
+
+    size_t len = piece_table_read(&edt->command_buffer.text, 0, PATTERN_CAP - 1, edt->search_pattern);
+    edt->search_pattern[len] = '\0';
+
+    if (len == 0) return;
 
-    for (size_t i = 0; i < b.index; i++)
+    if (pattern_compile(&edt->search.pattern, edt->search_pattern, len) < 0)
     {
-        if (b.text.data[i] == '\n') row += 1;
+        editor_set_status(edt, "Invalid pattern '%s'", edt->search_pattern);
+        return;
     }
 
-    return row;
+    edt->search.active = 1;
+    editor_search_resume(edt);
 }
 
-void buffer_update_scroll(Buffer *b, Vector2 font_size)
+// Restarts the search on buffers edited or loaded since, and reports the
+// count once all of them have been searched
+void editor_poll_search(Editor *edt)
 {
-    Vector2 cursor_pos = {
-        buffer_get_col(*b) * font_size.x,
-        buffer_get_row(*b) * font_size.y
-    };
+    Search *search = &edt->search;
 
-    if (cursor_pos.x < b->scroll.x)
-        b->scroll.x = cursor_pos.x;
-    else if (cursor_pos.x + font_size.x > b->scroll.x + GetScreenWidth())
-        b->scroll.x = cursor_pos.x + font_size.x - GetScreenWidth();
+    // Reaps a worker cancelled by a clear
+    if (!search->active)
+    {
+        if (search->started) search_stop(search, 0);
+        return;
+    }
 
-    if (cursor_pos.y < b->scroll.y)
-        b->scroll.y = cursor_pos.y;
-    else if (cursor_pos.y + font_size.y > b->scroll.y + GetScreenHeight())
-        b->scroll.y = cursor_pos.y + font_size.y - GetScreenHeight();
-}
+    int stale = search->targets_len < edt->buffers_len;
 
-void buffer_insert(Buffer *b, char c)
-{
-    string_insert(&b->text, b->index, c);
-    b->index += 1;
+    for (size_t i = 0; i < edt->buffers_len && !stale; i++)
+    {
+        Buffer *buf = edt->buffers[i];
+        SearchTarget *t = &search->targets[i];
+
+        if (buf->loaded && buf->loader == NULL && (t->text != &buf->text || t->edit_count != buf->text.edit_count))
+            stale = 1;
+    }
+
+    if (stale)
+    {
+        editor_search_resume(edt);
+        return;
+    }
+
+    if (search->started && !atomic_load(&search->running))
+    {
+        // A worker left over from the previous pattern says nothing about this one
+        int current = search->run_generation == search->generation;
+        search_stop(search, 0);
+
+        if (current && !edt->search_reported)
+        {
+            size_t matches = 0, buffers = 0;
+            int capped = 0;
+
+            for (size_t i = 0; i < search->targets_len; i++)
+            {
+                matches += search->targets[i].matches_len;
+                buffers += search->targets[i].matches_len > 0;
+                capped |= search->targets[i].capped;
+            }
+
+            if (search->unreadable > 0)
+            {
+                editor_set_status(
+                    edt, "/%s: %zu%s matches in %zu buffers, %zu couldn't be read", edt->search_pattern,
+                    matches, capped ? "+" : "", buffers, search->unreadable
+                );
+            }
+            else
+            {
+                editor_set_status(edt, "/%s: %zu%s matches in %zu buffers", edt->search_pattern, matches, capped ? "+" : "", buffers);
+            }
+            edt->search_reported = 1;
+        }
+    }
 }
 
-void buffer_delete(Buffer *b)
+// Moves to the next or previous match in the active buffer, wrapping around.
+// `inclusive` accepts a match right at the cursor.
+void editor_search_jump(Editor *edt, int forward, int inclusive)
 {
-    if (b->index < 1) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    SearchTarget *t = search_target_of(&edt->search, &buf->text);
+
+    pthread_mutex_lock(&edt->search.lock);
+
+    size_t count = t != NULL ? t->matches_len : 0;
 
-    size_t char_start = b->index - 1;
+    if (count > 0)
+    {
+        size_t i;
 
-    while (char_start > 0 && (b->text.data[char_start] & 0xC0) == 0x80)
-        char_start -= 1;
+        if (forward)
+        {
+            i = search_target_lower_bound(t, buf->index + (inclusive ? 0 : 1));
+            if (i == count) i = 0;
+        }
+        else
+        {
+            i = search_target_lower_bound(t, buf->index);
+            i = i == 0 ? count - 1 : i - 1;
+        }
 
-    int byte_len = 0;
-    GetCodepoint(&b->text.data[char_start], &byte_len);
+        buf->index = t->matches[i].start;
+    }
 
-    for (int i = 0; i < byte_len; i++)
-        string_delete(&b->text, char_start + 1);
+    pthread_mutex_unlock(&edt->search.lock);
 
-    b->index = char_start;
+    if (count == 0 && edt->search.active) editor_set_status(edt, "No matches for /%s", edt->search_pattern);
 }
 
-void buffer_move_right(Buffer *b)
+// Copies out the matches between `first` and `last` in the active buffer,
+// bumping their version when they are not the same as last frame
+void editor_update_visible_matches(Editor *edt, size_t first, size_t last)
 {
-    if (b->index >= b->text.len) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    SearchTarget *t = search_target_of(&edt->search, &buf->text);
+
+    pthread_mutex_lock(&edt->search.lock);
+
+    size_t lo = 0, hi = 0;
 
-    b->index += 1;
+    if (t != NULL)
+    {
+        lo = search_target_lower_bound(t, first);
+        hi = search_target_lower_bound(t, last);
+    }
+
+    // The worker only ever appends, so the same slice of the same
+    // generation holds the same matches
+    size_t key[5] = {(size_t)t, edt->search.generation, t != NULL ? t->edit_count : 0, lo, hi};
+
+    if (memcmp(key, edt->visible_key, sizeof(key)) != 0)
+    {
+        memcpy(edt->visible_key, key, sizeof(key));
+
+        if (edt->visible_matches_cap < hi - lo)
+        {
+            edt->visible_matches_cap = hi - lo;
+            edt->visible_matches = realloc(edt->visible_matches, edt->visible_matches_cap * sizeof(Match));
+            assert(edt->visible_matches != NULL && "Failed to realloc visible matches");
+        }
 
-    // Properly skip UTF-8 bytes
-    while (b->index < b->text.len && (b->text.data[b->index] & 0xC0) == 0x80)
-        b->index += 1;
+        if (hi > lo) memcpy(edt->visible_matches, t->matches + lo, (hi - lo) * sizeof(Match));
+        edt->visible_matches_len = hi - lo;
+        edt->visible_matches_version += 1;
+    }
+
+    pthread_mutex_unlock(&edt->search.lock);
 }
 
-void buffer_move_left(Buffer *b)
+void editor_draw_status(Editor *edt)
 {
-    if (b->index < 1) return;
+    if (!editor_status_visible(edt)) return;
+
+    int codepoints = 0;
+    for (const char *c = edt->status; *c != '\0'; c++)
+        if ((*c & 0xC0) != 0x80) codepoints += 1;
+
+    Rectangle bounds = {0};
+    bounds.width  = (codepoints + 2) * edt->font_size.x;
+    bounds.height = edt->font_size.y;
+    bounds.x      = GetScreenWidth() - bounds.width;
+    bounds.y      = GetScreenHeight() - bounds.height;
+
+    DrawRectangleRec(bounds, GetColor(COLOR_CMD));
+
+    Vector2 position = {bounds.x + edt->font_size.x, bounds.y};
+
+    for (const char *c = edt->status; *c != '\0';)
+    {
+        int size = 0;
+        int codepoint = GetCodepointNext(c, &size);
 
-    b->index -= 1;
+        glyph_cache_draw(&edt->font, codepoint, position, GetColor(COLOR_FG));
 
-    // Properly skip UTF-8 bytes
-    while (b->index > 0 && (b->text.data[b->index] & 0xC0) == 0x80)
-        b->index -= 1;
+        position.x += edt->font_size.x;
+        c += size;
+    }
 }
 
-size_t buffer_get_line_len(Buffer b, size_t pos)
+// Wraps the active buffer at the width of the window and counts its rows a
+// slice per frame, returns 1 while some are left. The view stays on the same
+// text while the layout changes under it, when the window is resized or the
+// rows above it get counted.
+int editor_update_wrap(Editor *edt, Buffer *buf)
 {
-    if (pos >= b.text.len) return 0;
+    WrapLayout *wrap = &buf->wrap;
+
+    size_t width = 0;
+    if (edt->wrap) width = (size_t)(GetScreenWidth() / edt->font_size.x);
+    if (edt->wrap && width == 0) width = 1;
 
-    size_t line_begin = pos;
+    // Where the view is, as laid out last frame
+    float top = buf->scroll.y / edt->font_size.y;
+    size_t sub = 0;
+    size_t row = wrap_layout_find(wrap, (size_t)top, &sub);
+    size_t col = sub * wrap->width;
 
-    while (line_begin > 0 && b.text.data[line_begin-1] != '\n') line_begin--;
+    wrap_layout_set_width(wrap, width);
+    int pending = wrap_layout_advance(wrap, WRAP_SLICE);
 
-    size_t line_end = pos;
+    // The rows on screen go first
+    size_t rows = piece_table_rows(&buf->text);
+    size_t screen_rows = (size_t)(GetScreenHeight() / edt->font_size.y) + 2;
 
-    while (line_end < b.text.len && b.text.data[line_end] != '\n') line_end++;
+    for (size_t r = row, shown = 0; r < rows && shown < screen_rows; r++)
+        shown += wrap_layout_rows_of(wrap, r);
 
-    return line_end - line_begin;
+    size_t vcol = 0;
+    buf->scroll.y = (wrap_layout_locate(wrap, row, col, &vcol) + top - floorf(top)) * edt->font_size.y;
+
+    return pending;
 }
 
-void buffer_move_down(Buffer *b)
+void editor_update_cursor(Editor *edt)
 {
-    size_t line_end = b->index;
-    size_t col = buffer_get_col(*b);
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    while (line_end < b->text.len && b->text.data[line_end] != '\n') line_end += 1;
+    if (edt->mode == MODE_COMMAND || edt->mode == MODE_SEARCH)
+    {
+        Buffer cmd_buf = edt->command_buffer;
 
-    if (line_end >= b->text.len) return;
+        edt->cursor.x =
+            (edt->command_bounds.x + edt->command_padding) +
+            edt->font_size.x +
+            buffer_get_col(cmd_buf) *
+            edt->font_size.x - cmd_buf.scroll.x;
 
-    size_t new_index = line_end + 1;
+        edt->cursor.y =
+            (edt->command_bounds.y + edt->command_padding) +
+            buffer_get_row(cmd_buf) *
+            edt->font_size.y - cmd_buf.scroll.y;
 
-    size_t current_col = 0;
+    } else {
+        size_t col = 0;
+        size_t row = wrap_layout_locate(&buf->wrap, buffer_get_row(*buf), buffer_get_col(*buf), &col);
 
-    while (new_index < b->text.len && b->text.data[new_index] != '\n' && current_col < col)
-    {
-        if ((b->text.data[new_index] & 0xC0) != 0x80) current_col++;
-        new_index++;
+        edt->cursor.x = col * edt->font_size.x - buf->scroll.x;
+        edt->cursor.y = row * edt->font_size.y - buf->scroll.y;
     }
 
-    while (new_index < b->text.len && (b->text.data[new_index] & 0xC0) == 0x80)
+    edt->cursor.width = edt->mode == MODE_NORMAL ? edt->font_size.x : edt->font_size.x / 6;
+}
+
+// Clipboard text, NULL when there is none. Replays don't touch the clipboard,
+// it would be whatever it is when they run.
+const char *editor_clipboard(Editor *edt)
+{
+    const char *text = edt->input.replay == NULL ? GetClipboardText() : NULL;
+
+    if (text == NULL || text[0] == '\0')
     {
-        new_index++;
+        editor_set_status(edt, "Nothing in the clipboard");
+        return NULL;
     }
 
-    b->index = new_index;
+    return text;
 }
 
-void buffer_move_up(Buffer *b)
+// Copies the bytes from `start` up to `end` of the active buffer to the
+// unnamed register and the picked one
+void editor_yank(Editor *edt, size_t start, size_t end, int linewise)
 {
-    size_t line_begin = b->index;
-    size_t col = buffer_get_col(*b);
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    Register *unnamed = &edt->registers[0];
 
-    while (line_begin > 0 && b->text.data[line_begin-1] != '\n') line_begin -= 1;
+    buffer_copy_range(buf, start, end, &unnamed->text);
+    unnamed->linewise = linewise;
 
-    if (line_begin == 0) return;
+    // Whole lines end in a newline, the last line of a file might not
+    if (linewise && (unnamed->text.len == 0 || unnamed->text.data[unnamed->text.len - 1] != '\n'))
+        string_append(&unnamed->text, "\n", 1);
 
-    size_t line_above_start = line_begin - 1;
-    while (
-        line_above_start > 0 && b->text.data[line_above_start-1] != '\n'
-    ) line_above_start -= 1;
+    Register *named = register_get(edt->registers, edt->register_name);
 
-    size_t new_index = line_above_start;
-    size_t current_col = 0;
-
-    while (new_index < line_begin - 1 && current_col < col)
+    if (edt->register_name == '+' && edt->input.replay == NULL)
     {
-        if ((b->text.data[new_index] & 0xC0) != 0x80) current_col++;
-        new_index++;
+        SetClipboardText(unnamed->text.data);
     }
-
-    while (new_index < b->text.len && (b->text.data[new_index] & 0xC0) == 0x80)
+    else if (named != NULL && named != unnamed)
     {
-        new_index++;
+        named->text.len = 0;
+        string_append(&named->text, unnamed->text.data, unnamed->text.len);
+        named->linewise = linewise;
     }
 
-    b->index = new_index;
+    edt->register_name = 0;
 }
 
-void buffer_move_line_begin(Buffer *b)
+// Yanks the cursor's line and takes it out of the buffer
+void editor_delete_line(Editor *edt)
 {
-    if (b->index == 0) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    size_t diff = b->index;
+    size_t start = piece_table_line_begin(&buf->text, buf->index);
+    size_t end = piece_table_next_newline(&buf->text, buf->index);
 
-    for (size_t i = b->index; i > 0; i--)
-    {
-        if (b->text.data[i-1] == '\n') break;
+    if (end < buf->text.len) end += 1;
+    editor_yank(edt, start, end, 1);
 
-        diff -= 1;
-    }
+    // The last line takes the newline before it instead
+    if (end == buf->text.len && buf->text.len > 0 && piece_table_get(&buf->text, end - 1) != '\n' && start > 0)
+        start -= 1;
 
-    b->index = diff;
+    buffer_delete_range(buf, start, end);
+    buf->index = piece_table_line_begin(&buf->text, start < buf->text.len ? start : buf->text.len);
 }
 
-void buffer_move_line_end(Buffer *b)
+// Puts the picked register after the cursor, or before it, as one edit
+void editor_put(Editor *edt, int before)
 {
-    if (b->index == b->text.len) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    size_t plus = b->index;
+    const char *data = NULL;
+    size_t len = 0;
+    int linewise = 0;
 
-    for (size_t i = b->index; i < b->text.len; i++)
+    if (edt->register_name == '+')
     {
-        if (b->text.data[i] == '\n') break;
-        plus += 1;
+        data = editor_clipboard(edt);
+        len = data != NULL ? strlen(data) : 0;
+        linewise = len > 0 && data[len - 1] == '\n';
+    }
+    else
+    {
+        Register *reg = register_get(edt->registers, edt->register_name);
+        data = reg->text.data;
+        len = reg->text.len;
+        linewise = reg->linewise;
     }
 
-    b->index = plus;
-}
-
-void buffer_new_line_bellow(Buffer *b)
-{
-    size_t line_end = b->index;
+    edt->register_name = 0;
+    if (len == 0) return;
 
-    for (size_t i = b->index; i < b->text.len; i++)
+    if (linewise)
     {
-        line_end = i;
-        if (b->text.data[i] == '\n') break;
-    }
+        size_t pos = before
+            ? piece_table_line_begin(&buf->text, buf->index)
+            : piece_table_next_newline(&buf->text, buf->index);
 
-    string_insert(&b->text, line_end, '\n');
-    b->index = line_end+1;
-}
+        // Below a last line without a newline, the newline comes first
+        if (!before && pos == buf->text.len)
+        {
+            buf->index = pos;
+            history_begin_group(&buf->history);
+            buffer_insert_bytes(buf, "\n", 1);
+            buffer_insert_bytes(buf, data, len - 1);
+            history_end_group(&buf->history);
+            buf->index = pos + 1;
+            return;
+        }
 
-void buffer_new_line_above(Buffer *b)
-{
-    size_t line_start = b->index;
+        if (!before) pos += 1;
 
-    while (line_start > 0 && b->text.data[line_start-1] != '\n')
+        buf->index = pos;
+        buffer_insert_bytes(buf, data, len);
+        buf->index = pos;
+    }
+    else
     {
-        line_start -= 1;
+        if (!before && piece_table_get(&buf->text, buf->index) != '\n') buffer_move_right(buf);
+
+        // On the last character put
+        buffer_insert_bytes(buf, data, len);
+        buffer_move_left(buf);
     }
+}
 
-    string_insert(&b->text, line_start, '\n');
-    b->index = line_start;
+// Leaving insert mode steps back onto the last character typed, unless
+// that would go up a line
+void buffer_move_left_in_line(Buffer *b)
+{
+    if (piece_table_get(&b->text, b->index-1) != '\n') buffer_move_left(b);
 }
 
-void buffer_move_next_word(Buffer *b)
+// Adds a cursor on the first search match past the last cursor, which
+// becomes the main one so the view follows it
+void editor_add_cursor_at_match(Editor *edt)
 {
-    if (b->index >= b->text.len) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    SearchTarget *t = search_target_of(&edt->search, &buf->text);
+
+    size_t after = buf->index;
+    if (buf->cursors_len > 0 && buf->cursors[buf->cursors_len - 1] > after) after = buf->cursors[buf->cursors_len - 1];
 
-    size_t next_word = b->index;
+    pthread_mutex_lock(&edt->search.lock);
 
-    // Cursor is on top of characters
-    while (next_word < b->text.len && !isspace(b->text.data[next_word]))
+    size_t next = SIZE_MAX;
+
+    if (t != NULL)
     {
-        next_word += 1;
+        size_t i = search_target_lower_bound(t, after + 1);
+        if (i < t->matches_len) next = t->matches[i].start;
     }
 
-    // Cursor reached empty line
-    if (
-        next_word < b->text.len &&
-        b->text.data[next_word] == '\n' && b->text.data[next_word+1] == '\n'
-    ) {
-        next_word += 1;
-        b->index = next_word;
+    pthread_mutex_unlock(&edt->search.lock);
+
+    if (next == SIZE_MAX)
+    {
+        editor_set_status(edt, "No more matches for /%s", edt->search_pattern);
         return;
     }
 
-    // Cursor is on top of whitespace
-    while (next_word < b->text.len && isspace(b->text.data[next_word]))
+    size_t main = buf->index;
+    buf->index = next;
+    buffer_add_cursor(buf, main);
+}
+
+// A cursor on every row from first to last, at the column of the main one
+// where the row is long enough
+void editor_add_cursors(Editor *edt, size_t first_row, size_t last_row)
+{
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    size_t col = buffer_get_col(*buf);
+
+    for (size_t row = first_row; row <= last_row; row++)
     {
-        next_word += 1;
+        size_t line_begin = piece_table_row_start(&buf->text, row);
+        size_t line_end = piece_table_next_newline(&buf->text, line_begin);
+
+        buffer_add_cursor(buf, piece_table_skip_codepoints(&buf->text, line_begin, line_end, col));
     }
 
-    b->index = next_word;
+    editor_set_status(edt, "%zu cursors", buf->cursors_len + 1);
 }
 
-void buffer_move_prev_word(Buffer *b)
+// The cursors besides the main one that fall between `first` and `last`,
+// the main one is drawn by the text layer
+void editor_draw_cursors(Editor *edt, size_t first, size_t last)
 {
-    if (b->index < 1) return;
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    size_t prev_word = b->index;
+    size_t lo = 0, hi = buf->cursors_len;
 
-    // Cursor is on top of whitespace
-    while (prev_word > 0 && isspace(b->text.data[prev_word-1]))
+    while (lo < hi)
     {
-        if (
-            prev_word >= 2 &&
-            b->text.data[prev_word-1] == '\n' && isspace(b->text.data[prev_word-2])
-        ) {
-            b->index = prev_word-1;
-            return;
-        }
-        prev_word -= 1;
+        size_t mid = lo + (hi - lo) / 2;
+        if (buf->cursors[mid] < first) lo = mid + 1;
+        else hi = mid;
     }
 
-    // Cursor is on top of characters
-    while (prev_word > 0 && !isspace(b->text.data[prev_word-1]))
+    for (size_t k = lo; k < buf->cursors_len && buf->cursors[k] < last; k++)
     {
-        prev_word -= 1;
-    }
+        size_t row = piece_table_row_of(&buf->text, buf->cursors[k]);
+        size_t col = piece_table_count_codepoints(&buf->text, piece_table_row_start(&buf->text, row), buf->cursors[k]);
+        row = wrap_layout_locate(&buf->wrap, row, col, &col);
+
+        Rectangle cursor = edt->cursor;
+        cursor.x = col * edt->font_size.x - buf->scroll.x;
+        cursor.y = row * edt->font_size.y - buf->scroll.y;
 
-    b->index = prev_word;
+        DrawRectangleRec(cursor, Fade(GetColor(COLOR_CURSOR), 0.5));
+    }
 }
 
-void draw_characters(Font font, const char *text, Vector2 origin, Vector2 font_size, Vector2 scroll, Vector2 cursor_pos)
-{
-    Vector2 cell_pos = {-scroll.x, -scroll.y};
-    cell_pos = Vector2Add(cell_pos, origin);
+// Replaces `pattern` with `with` on rows first to last, only the first
+// match of each row unless `global`. All the matches are found first, a
+// chunk of whole lines at a time, then replaced as a single edit.
+void editor_substitute(
+    Editor *edt, size_t first_row, size_t last_row, const char *pattern, size_t pattern_len,
+    const char *with, size_t with_len, int global
+) {
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    PieceTable *text = &buf->text;
+
+    // The rest of the file would be left out
+    if (buf->loader != NULL)
+    {
+        editor_set_status(edt, "Still loading '%s'", buf->filepath);
+        return;
+    }
 
-    size_t i = 0;
+    Pattern p = {0};
+    if (pattern_len == 0 || pattern_compile(&p, pattern, pattern_len) < 0)
+    {
+        editor_set_status(edt, "Invalid pattern '%.*s'", (int)pattern_len, pattern);
+        return;
+    }
+
+    size_t pos = piece_table_row_start(text, first_row);
+    size_t end = piece_table_row_start(text, last_row + 1);
 
-    while (text[i] != '\0')
+    Match *matches = NULL;
+    size_t matches_len = 0, matches_cap = 0;
+    size_t lines = 0;
+    String chunk = {0};
+
+    while (pos < end)
     {
-        int byte_len = 0;
-        int codepoint = GetCodepoint(&text[i], &byte_len);
+        // Up to the end of a line, so no match is cut in half
+        size_t chunk_end = end - pos > SUBSTITUTE_CHUNK ? pos + SUBSTITUTE_CHUNK : end;
+        if (chunk_end < end) chunk_end = piece_table_next_newline(text, chunk_end) + 1;
+        if (chunk_end > end) chunk_end = end;
+
+        buffer_copy_range(buf, pos, chunk_end, &chunk);
+
+        size_t from = 0, start = 0, len = 0;
+        size_t prev_end = 0;
+
+        PatternBounds bounds = PATTERN_LINE_START | PATTERN_LINE_END;
 
-        if (codepoint == '\n')
+        while (pattern_find(&p, chunk.data, chunk.len, from, bounds, &start, &len, NULL))
         {
-            cell_pos.x = -scroll.x + origin.x;
-            cell_pos.y += font_size.y;
-            i += byte_len;
-            continue;
+            // Chunks start lines, so only a newline since the last match in
+            // this one can tell whether it is on the same line
+            int same_line = from > 0 && scan_next_newline(chunk.data + prev_end, start - prev_end) == start - prev_end;
+            lines += !same_line;
+            prev_end = start + len;
+
+            if (matches_len >= matches_cap)
+            {
+                matches_cap = matches_cap == 0 ? 1024 : matches_cap * 2;
+                matches = realloc(matches, matches_cap * sizeof(*matches));
+                assert(matches != NULL && "Failed to realloc substitute matches");
+            }
+
+            matches[matches_len++] = (Match){pos + start, len};
+            from = start + len;
+
+            if (!global) from += scan_next_newline(chunk.data + from, chunk.len - from) + 1;
         }
 
-        Color color = GetColor(COLOR_FG);
-        if (Vector2Equals(cell_pos, cursor_pos)) color = GetColor(COLOR_BG);
+        pos = chunk_end;
+    }
 
-        DrawTextCodepoint(font, codepoint, cell_pos, FONT_SIZE, color);
+    free(chunk.data);
 
-        cell_pos.x += font_size.x;
-        i += byte_len;
+    if (matches_len == 0)
+    {
+        editor_set_status(edt, "Pattern not found '%.*s'", (int)pattern_len, pattern);
+        free(matches);
+        return;
     }
+
+    size_t last = buffer_replace(buf, matches, matches_len, with, with_len);
+    buf->index = piece_table_line_begin(text, last);
+
+    editor_set_status(edt, "%zu substitutions on %zu lines", matches_len, lines);
+    free(matches);
 }
 
-typedef enum {
-    MODE_NORMAL = 0,
-    MODE_INSERT,
-    MODE_COMMAND,
-} Mode;
+#define MB(bytes) ((bytes) / (1024.0*1024.0))
 
-#define BUFFER_LIST_CAP 16
+// What the active buffer holds and, after it, all of them together
+void editor_report_memory(Editor *edt)
+{
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    BufferUsage u = buffer_usage(buf);
+    MemoryUsage m = buffer_usage_total(u);
 
-typedef struct {
-    Buffer buffers[BUFFER_LIST_CAP];
-    size_t buffers_len;
-    size_t active_buffer;
+    MemoryUsage all = {0};
+    for (size_t i = 0; i < edt->buffers_len; i++)
+    {
+        MemoryUsage b = buffer_usage_total(buffer_usage(edt->buffers[i]));
+        memory_usage_add(&all, b.used, b.reserved);
+    }
 
-    Font font;
-    Vector2 font_size;
-    Rectangle command_bounds;
-    Buffer command_buffer;
-    int command_padding;
-    Mode mode;
-    Rectangle cursor;
-} Editor;
+    editor_set_status(edt,
+        "%.1f MB used, %.1f reserved, %.1f wasted (text %.1f, history %.1f, other %.1f), %.1f mapped; %zu buffers %.1f used, %.1f reserved",
+        MB(m.used), MB(m.reserved), MB(m.reserved - m.used),
+        MB(u.text.used), MB(u.history.used), MB(u.other.used), MB(u.mapped),
+        edt->buffers_len, MB(all.used), MB(all.reserved));
+}
 
-void editor_init(Editor *edt)
+// Reads a line address at `*i`: `.`, `$` or a line number, and then any
+// number of `+n` or `-n`. Returns 0 when there is none there.
+int command_parse_address(const char *command, size_t *i, size_t current, size_t last, size_t *row)
 {
-    const char *font_path = "resources/DepartureMono/DepartureMono-Regular.otf";
-    edt->font = LoadFontEx(font_path, FONT_SIZE, 0, CODEPOINT_LEN);
-    edt->font_size = MeasureTextEx(edt->font, "X", FONT_SIZE, 0);
+    int found = 1;
+    long long value = (long long)current;
+
+    if (command[*i] == '.')
+    {
+        *i += 1;
+    }
+    else if (command[*i] == '$')
+    {
+        value = (long long)last;
+        *i += 1;
+    }
+    else if (isdigit((unsigned char)command[*i]))
+    {
+        value = 0;
+        while (isdigit((unsigned char)command[*i])) value = value * 10 + (command[(*i)++] - '0');
+        value -= 1; // Lines count from one
+    }
+    else
+    {
+        found = 0;
+    }
 
-    Buffer cmd = {0};
-    buffer_empty(&cmd);
-    edt->command_buffer = cmd;
-    edt->command_padding = (int)edt->font_size.x / 1.5;
+    while (command[*i] == '+' || command[*i] == '-')
+    {
+        int sign = command[(*i)++] == '+' ? 1 : -1;
+        long long offset = isdigit((unsigned char)command[*i]) ? 0 : 1;
+        while (isdigit((unsigned char)command[*i])) offset = offset * 10 + (command[(*i)++] - '0');
 
-    edt->mode = MODE_NORMAL;
+        value += sign * offset;
+        found = 1;
+    }
 
-    edt->cursor.width = edt->font_size.x;
-    edt->cursor.height = edt->font_size.y;
+    if (value < 0) value = 0;
+    if (value > (long long)last) value = (long long)last;
+
+    *row = (size_t)value;
+    return found;
 }
 
-void editor_new_buffer(Editor *edt)
-{
-    Buffer buf = {0};
-    buffer_empty(&buf);
+// Splits `s/pattern/with/flags` at `*i`, the delimiter being whatever comes
+// after the `s`. The pattern keeps its escapes for pattern_compile, `with`
+// loses them: `\n` is a newline, `\t` a tab and `\x` is `x`. Returns -1 when
+// it is malformed.
+int command_parse_substitute(
+    const char *command, size_t i, char *pattern, size_t *pattern_len, char *with, size_t *with_len, int *global
+) {
+    char delim = command[i++];
+    if (delim == '\0' || isalnum((unsigned char)delim) || delim == '\\' || isspace((unsigned char)delim)) return -1;
+
+    *pattern_len = 0;
+    while (command[i] != '\0' && command[i] != delim)
+    {
+        if (command[i] == '\\' && command[i + 1] == delim) i += 1;
+        else if (command[i] == '\\' && command[i + 1] != '\0') pattern[(*pattern_len)++] = command[i++];
 
-    edt->buffers[edt->buffers_len++] = buf;
-}
+        pattern[(*pattern_len)++] = command[i++];
+    }
 
-void editor_load_file(Editor *edt, const char *file_path)
-{
-    Buffer buf = {0};
-    buffer_load_from_file(&buf, file_path);
+    *with_len = 0;
+    if (command[i] == delim) i += 1;
 
-    edt->buffers[edt->buffers_len++] = buf;
-}
+    while (command[i] != '\0' && command[i] != delim)
+    {
+        char c = command[i++];
 
-void editor_save_file(Editor *edt)
-{
-    Buffer *buf = &edt->buffers[edt->active_buffer];
+        if (c == '\\' && command[i] != '\0')
+        {
+            c = command[i++];
+            if (c == 'n' || c == 'r') c = '\n';
+            else if (c == 't') c = '\t';
+        }
+
+        with[(*with_len)++] = c;
+    }
 
-    FILE *file = fopen(buf->filepath, "w");
-    assert(file != NULL && "Failed to open file for saving");
+    *global = 0;
+    if (command[i] == delim) i += 1;
 
-    if (buf->text.len > 0) {
-        size_t bytes_written = fwrite(buf->text.data, sizeof(char), buf->text.len, file);
-        assert(bytes_written == buf->text.len && "Failed to write to file");
-        if (buf->text.data[bytes_written-1] != '\n') fputc('\n', file);
+    for (; command[i] != '\0'; i++)
+    {
+        if (command[i] == 'g') *global = 1;
+        else return -1;
     }
 
-    fclose(file);
-    printf("File '%s' was saved\n", buf->filepath);
+    return 0;
 }
 
-void editor_update_cursor(Editor *edt)
+// Ex commands: an optional range of lines, `%` for all of them or one or two
+// addresses, and then `w`, `s/pattern/with/g`, `cursors` to put a cursor on
+// each line, or nothing to go to the line
+void editor_run_command(Editor *edt, const char *command)
 {
-    Buffer *buf = &edt->buffers[edt->active_buffer];
+    Buffer *buf = edt->buffers[edt->active_buffer];
+
+    size_t current = buffer_get_row(*buf);
+    size_t last = piece_table_rows(&buf->text) - 1;
+    size_t first_row = current, last_row = current;
+    int ranged = 0;
 
-    if (edt->mode == MODE_COMMAND)
+    size_t i = 0;
+    while (command[i] == ' ' || command[i] == ':') i++;
+
+    if (command[i] == '%')
     {
-        Buffer cmd_buf = edt->command_buffer;
+        first_row = 0;
+        last_row = last;
+        ranged = 1;
+        i += 1;
+    }
+    else if (command_parse_address(command, &i, current, last, &first_row))
+    {
+        last_row = first_row;
+        ranged = 1;
 
-        edt->cursor.x =
-            (edt->command_bounds.x + edt->command_padding) +
-            edt->font_size.x +
-            buffer_get_col(cmd_buf) *
-            edt->font_size.x - cmd_buf.scroll.x;
+        if (command[i] == ',')
+        {
+            i += 1;
+            if (!command_parse_address(command, &i, current, last, &last_row))
+            {
+                editor_set_status(edt, "Invalid range '%s'", command);
+                return;
+            }
+        }
+    }
 
-        edt->cursor.y =
-            (edt->command_bounds.y + edt->command_padding) +
-            buffer_get_row(cmd_buf) *
-            edt->font_size.y - cmd_buf.scroll.y;
+    // Backwards ranges are turned around, like vim offers to
+    if (first_row > last_row)
+    {
+        size_t row = first_row;
+        first_row = last_row;
+        last_row = row;
+    }
 
-    } else {
-        edt->cursor.x = buffer_get_col(*buf) * edt->font_size.x - buf->scroll.x;
-        edt->cursor.y = buffer_get_row(*buf) * edt->font_size.y - buf->scroll.y;
+    while (command[i] == ' ') i++;
+
+    if (command[i] == '\0' && ranged)
+    {
+        buf->index = piece_table_row_start(&buf->text, last_row);
     }
+    else if (strcmp(command + i, "w") == 0 && !ranged)
+    {
+        editor_save_file(edt);
+    }
+    else if (strcmp(command + i, "cursors") == 0)
+    {
+        editor_add_cursors(edt, first_row, last_row);
+    }
+    else if (strcmp(command + i, "history") == 0 && !ranged)
+    {
+        size_t undo = 0, redo = 0;
+        history_steps(&buf->history, &undo, &redo);
 
-    edt->cursor.width = edt->mode == MODE_NORMAL ? edt->font_size.x : edt->font_size.x / 6;
+        editor_set_status(edt, "%zu changes to undo, %zu to redo, %.1f of %.1f MB",
+            undo, redo, MB(history_memory(&buf->history)), MB(buf->history.cap));
+    }
+    else if (strcmp(command + i, "mem") == 0 && !ranged)
+    {
+        editor_report_memory(edt);
+    }
+    else if (strcmp(command + i, "wrap") == 0 && !ranged)
+    {
+        edt->wrap = !edt->wrap;
+        editor_set_status(edt, edt->wrap ? "Wrapping long lines" : "Not wrapping long lines");
+    }
+    else if (command[i] == 's')
+    {
+        char pattern[COMMAND_CAP], with[COMMAND_CAP];
+        size_t pattern_len = 0, with_len = 0;
+        int global = 0;
+
+        if (command_parse_substitute(command, i + 1, pattern, &pattern_len, with, &with_len, &global) < 0)
+            editor_set_status(edt, "Invalid substitute '%s'", command);
+        else
+            editor_substitute(edt, first_row, last_row, pattern, pattern_len, with, with_len, global);
+    }
+    else
+    {
+        editor_set_status(edt, "Not a command '%s'", command);
+    }
 }
 
-float key_down_timer = 0.0;
-float key_down_repeat_time = 0.2;
-
 void handle_normal_mode(Editor *edt)
 {
-    Buffer *buf = &edt->buffers[edt->active_buffer];
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    if (IsKeyPressed(KEY_RIGHT))
+    if (input_pressed(&edt->input, KEY_RIGHT))
     {
-        edt->active_buffer =
+        editor_activate_buffer(edt,
             edt->active_buffer >= edt->buffers_len - 1
             ? 0
-            : edt->active_buffer+1;
+            : edt->active_buffer+1);
     }
 
-    if (IsKeyPressed(KEY_LEFT))
+    if (input_pressed(&edt->input, KEY_LEFT))
     {
-        edt->active_buffer =
+        editor_activate_buffer(edt,
             edt->active_buffer < 1
             ? edt->buffers_len - 1
-            : edt->active_buffer - 1;
+            : edt->active_buffer - 1);
     }
 
-    if (IsKeyPressed(KEY_I))
+    if (input_pressed(&edt->input, KEY_I))
     {
         edt->mode = MODE_INSERT;
     }
 
-    if (IsKeyDown(KEY_L))
+    for (int n = input_repeat(&edt->input, KEY_L); n > 0; n--) buffer_cursors_move(buf, buffer_move_right);
+    for (int n = input_repeat(&edt->input, KEY_H); n > 0; n--) buffer_cursors_move(buf, buffer_move_left);
+    for (int n = input_repeat(&edt->input, KEY_J); n > 0; n--) buffer_cursors_move(buf, buffer_move_down);
+    for (int n = input_repeat(&edt->input, KEY_K); n > 0; n--) buffer_cursors_move(buf, buffer_move_up);
+
+    if (input_pressed(&edt->input, KEY_ZERO)) buffer_cursors_move(buf, buffer_move_line_begin);
+
+    if (input_down(&edt->input, KEY_RIGHT_CONTROL) || input_down(&edt->input, KEY_LEFT_CONTROL))
     {
-        key_down_timer += GetFrameTime();
-        if (IsKeyPressed(KEY_L)) buffer_move_right(buf);
-        if (key_down_timer >= key_down_repeat_time) buffer_move_right(buf);
+        if (input_pressed(&edt->input, KEY_N)) editor_add_cursor_at_match(edt);
+
+        if (input_pressed(&edt->input, KEY_R) && !buffer_redo(buf))
+            editor_set_status(edt, "Already at newest change");
     }
 
-    if (IsKeyDown(KEY_H))
+    if (input_pressed(&edt->input, KEY_N) && !input_down(&edt->input, KEY_LEFT_CONTROL) && !input_down(&edt->input, KEY_RIGHT_CONTROL))
     {
-        key_down_timer += GetFrameTime();
-        if (IsKeyPressed(KEY_H)) buffer_move_left(buf);
-        if (key_down_timer >= key_down_repeat_time) buffer_move_left(buf);
+        int backward = input_down(&edt->input, KEY_LEFT_SHIFT) || input_down(&edt->input, KEY_RIGHT_SHIFT);
+        editor_search_jump(edt, !backward, 0);
     }
 
-    if (IsKeyDown(KEY_J))
+    if (input_pressed(&edt->input, KEY_ESCAPE))
     {
-        key_down_timer += GetFrameTime();
-        if (IsKeyPressed(KEY_J)) buffer_move_down(buf);
-        if (key_down_timer >= key_down_repeat_time) buffer_move_down(buf);
+        edt->pending = 0;
+        edt->register_name = 0;
+        buf->cursors_len = 0;
     }
 
-    if (IsKeyDown(KEY_K))
+    // Looked up by character, the key for '/' depends on the layout
+    for (int codepoint = input_char(&edt->input); codepoint > 0; codepoint = input_char(&edt->input))
     {
-        key_down_timer += GetFrameTime();
-        if (IsKeyPressed(KEY_K)) buffer_move_up(buf);
-        if (key_down_timer >= key_down_repeat_time) buffer_move_up(buf);
-    }
+        int pending = edt->pending;
+        edt->pending = 0;
 
-    if (IsKeyReleased(KEY_L)) key_down_timer = 0;
-    if (IsKeyReleased(KEY_H)) key_down_timer = 0;
-    if (IsKeyReleased(KEY_J)) key_down_timer = 0;
-    if (IsKeyReleased(KEY_K)) key_down_timer = 0;
+        if (pending == '"')
+        {
+            if (codepoint == '"' || codepoint == '+' || (codepoint >= 'a' && codepoint <= 'z'))
+                edt->register_name = codepoint;
+        }
+        else if (pending == 'y' || pending == 'd')
+        {
+            if (codepoint == 'y' && pending == 'y')
+            {
+                size_t start = piece_table_line_begin(&buf->text, buf->index);
+                size_t end = piece_table_next_newline(&buf->text, buf->index);
+                editor_yank(edt, start, end < buf->text.len ? end + 1 : end, 1);
+            }
 
-    if (IsKeyPressed(KEY_ZERO)) buffer_move_line_begin(buf);
+            if (codepoint == 'd' && pending == 'd') editor_delete_line(edt);
+        }
+        else if (codepoint == '"' || codepoint == 'y' || codepoint == 'd')
+        {
+            edt->pending = codepoint;
+        }
+        else if (codepoint == 'p' || codepoint == 'P')
+        {
+            editor_put(edt, codepoint == 'P');
+        }
+        else if (codepoint == 'u')
+        {
+            if (!buffer_undo(buf)) editor_set_status(edt, "Already at oldest change");
+        }
+        else if (codepoint == '/')
+        {
+            edt->mode = MODE_SEARCH;
+        }
+    }
 
-    if (IsKeyPressed(KEY_O) && !IsKeyDown(KEY_LEFT_SHIFT))
+    if (input_pressed(&edt->input, KEY_O) && !input_down(&edt->input, KEY_LEFT_SHIFT))
     {
-        buffer_new_line_bellow(buf);
+        history_begin_group(&buf->history);
+        buffer_cursors_move(buf, buffer_move_line_end);
+        buffer_cursors_insert(buf, "\n", 1);
         edt->mode = MODE_INSERT;
     }
 
-    if (IsKeyDown(KEY_RIGHT_SHIFT) || IsKeyDown(KEY_LEFT_SHIFT))
+    if (input_down(&edt->input, KEY_RIGHT_SHIFT) || input_down(&edt->input, KEY_LEFT_SHIFT))
     {
-        if (IsKeyPressed(KEY_SEMICOLON))
+        if (input_pressed(&edt->input, KEY_SEMICOLON))
         {
             edt->mode = MODE_COMMAND;
         }
 
-        if (IsKeyPressed(KEY_W)) buffer_move_next_word(buf);
-        if (IsKeyPressed(KEY_B)) buffer_move_prev_word(buf);
+        if (input_pressed(&edt->input, KEY_W)) buffer_cursors_move(buf, buffer_move_next_word);
+        if (input_pressed(&edt->input, KEY_B)) buffer_cursors_move(buf, buffer_move_prev_word);
 
-        if (IsKeyPressed(KEY_A))
+        if (input_pressed(&edt->input, KEY_A))
         {
-            buffer_move_line_end(buf);
+            buffer_cursors_move(buf, buffer_move_line_end);
             edt->mode = MODE_INSERT;
         }
-        if (IsKeyPressed(KEY_I))
+        if (input_pressed(&edt->input, KEY_I))
         {
-            buffer_move_line_begin(buf);
+            buffer_cursors_move(buf, buffer_move_line_begin);
             edt->mode = MODE_INSERT;
         }
-        if (IsKeyPressed(KEY_FOUR)) buffer_move_line_end(buf);
-        if (IsKeyPressed(KEY_O))
+        if (input_pressed(&edt->input, KEY_FOUR)) buffer_cursors_move(buf, buffer_move_line_end);
+        if (input_pressed(&edt->input, KEY_O))
         {
-            buffer_new_line_above(buf);
+            // The new line's newline goes in front of the cursor's line
+            history_begin_group(&buf->history);
+            buffer_cursors_move(buf, buffer_move_line_begin);
+            buffer_cursors_insert(buf, "\n", 1);
+            buffer_cursors_move(buf, buffer_move_left);
             edt->mode = MODE_INSERT;
         }
     }
@@ -685,85 +3023,327 @@ void handle_normal_mode(Editor *edt)
 
 void handle_insert_mode(Editor *edt)
 {
-    int codepoint = GetCharPressed();
+    int codepoint = input_char(&edt->input);
 
-    Buffer *buf = &edt->buffers[edt->active_buffer];
+    Buffer *buf = edt->buffers[edt->active_buffer];
 
-    if (IsKeyPressed(KEY_ESCAPE) || IsKeyPressed(KEY_CAPS_LOCK))
+    if (input_pressed(&edt->input, KEY_ESCAPE) || input_pressed(&edt->input, KEY_CAPS_LOCK))
     {
         edt->mode = MODE_NORMAL;
-        if (buf->text.data[buf->index-1] != '\n') buffer_move_left(buf);
+        buffer_cursors_move(buf, buffer_move_left_in_line);
     }
 
-    if (IsKeyDown(KEY_RIGHT_CONTROL) || IsKeyDown(KEY_LEFT_CONTROL))
+    if (input_down(&edt->input, KEY_RIGHT_CONTROL) || input_down(&edt->input, KEY_LEFT_CONTROL))
     {
-        if (IsKeyPressed(KEY_C))
+        if (input_pressed(&edt->input, KEY_C))
         {
             edt->mode = MODE_NORMAL;
-            if (buf->text.data[buf->index-1] != '\n') buffer_move_left(buf);
+            buffer_cursors_move(buf, buffer_move_left_in_line);
+        }
+    }
+
+    if (input_down(&edt->input, KEY_RIGHT_CONTROL) || input_down(&edt->input, KEY_LEFT_CONTROL))
+    {
+        if (input_pressed(&edt->input, KEY_V))
+        {
+            const char *clipboard = editor_clipboard(edt);
+            if (clipboard != NULL) buffer_cursors_insert(buf, clipboard, strlen(clipboard));
         }
     }
 
-    if (IsKeyPressed(KEY_ENTER)) buffer_insert(buf, '\n');
+    if (input_pressed(&edt->input, KEY_ENTER)) buffer_cursors_insert(buf, "\n", 1);
 
-    if (IsKeyPressed(KEY_TAB))
+    if (input_pressed(&edt->input, KEY_TAB))
     {
-        for (int i = 0; i < TAB_SIZE; i++) buffer_insert(buf, ' ');
+        char spaces[TAB_SIZE];
+        memset(spaces, ' ', TAB_SIZE);
+        buffer_cursors_insert(buf, spaces, TAB_SIZE);
     }
 
-    if (IsKeyPressed(KEY_BACKSPACE)) buffer_delete(buf);
+    if (input_pressed(&edt->input, KEY_BACKSPACE)) buffer_cursors_delete(buf);
+
+    // Inserts there are dropped until the rest of the file is in
+    size_t last = buf->cursors_len > 0 && buf->cursors[buf->cursors_len - 1] > buf->index ? buf->cursors[buf->cursors_len - 1] : buf->index;
+    if (buffer_loading_tail(buf, last)) editor_set_status(edt, "Still loading '%s', can't type at its end yet", buf->filepath);
 
     while (codepoint > 0)
     {
         int len = 0;
         const char *char_encoded = CodepointToUTF8(codepoint, &len);
-        if (codepoint >= 32 && codepoint <= CODEPOINT_LEN)
-        {
-            for (int i = 0; i < len; i++) buffer_insert(buf, char_encoded[i]);
-        }
-        codepoint = GetCharPressed();
+        if (codepoint >= 32) buffer_cursors_insert(buf, char_encoded, len);
+        codepoint = input_char(&edt->input);
+    }
+}
+
+void handle_search_mode(Editor *edt)
+{
+    int codepoint = input_char(&edt->input);
+
+    if (input_pressed(&edt->input, KEY_ESCAPE) || input_pressed(&edt->input, KEY_CAPS_LOCK))
+    {
+        edt->mode = MODE_NORMAL;
+        search_clear(&edt->search);
+        if (edt->command_buffer.text.len > 0) buffer_clear(&edt->command_buffer);
+        return;
+    }
+
+    if (input_pressed(&edt->input, KEY_ENTER))
+    {
+        edt->mode = MODE_NORMAL;
+        if (edt->command_buffer.text.len > 0) buffer_clear(&edt->command_buffer);
+        editor_search_jump(edt, 1, 1);
+        return;
+    }
+
+    if (input_pressed(&edt->input, KEY_BACKSPACE)) buffer_delete(&edt->command_buffer);
+
+    while (codepoint > 0)
+    {
+        int len = 0;
+        const char *char_encoded = CodepointToUTF8(codepoint, &len);
+        if (codepoint >= 32) buffer_insert_bytes(&edt->command_buffer, char_encoded, len);
+        codepoint = input_char(&edt->input);
+    }
+
+    // Matches follow the pattern as it is typed
+    if (edt->command_buffer.text.edit_count != edt->search_edit_count)
+    {
+        edt->search_edit_count = edt->command_buffer.text.edit_count;
+        editor_search_start(edt);
     }
 }
 
 void handle_command_mode(Editor *edt)
 {
-    int codepoint = GetCharPressed();
+    int codepoint = input_char(&edt->input);
 
-    if (IsKeyPressed(KEY_ESCAPE) || IsKeyPressed(KEY_CAPS_LOCK))
+    if (input_pressed(&edt->input, KEY_ESCAPE) || input_pressed(&edt->input, KEY_CAPS_LOCK))
     {
         edt->mode = MODE_NORMAL;
         if (edt->command_buffer.text.len > 0) buffer_clear(&edt->command_buffer);
     }
 
-    if (IsKeyPressed(KEY_BACKSPACE)) buffer_delete(&edt->command_buffer);
+    if (input_pressed(&edt->input, KEY_BACKSPACE)) buffer_delete(&edt->command_buffer);
 
-    if (IsKeyPressed(KEY_ENTER))
+    if (input_pressed(&edt->input, KEY_ENTER))
     {
         if (edt->command_buffer.text.len > 0)
         {
-            if (strcmp(edt->command_buffer.text.data, "w") == 0)
-            {
-                editor_save_file(edt);
-                edt->mode = MODE_NORMAL;
-                if (edt->command_buffer.text.len > 0) buffer_clear(&edt->command_buffer);
-            }
+            char command[COMMAND_CAP] = {0};
+            piece_table_read(&edt->command_buffer.text, 0, COMMAND_CAP - 1, command);
+            editor_run_command(edt, command);
         }
+
+        edt->mode = MODE_NORMAL;
+        if (edt->command_buffer.text.len > 0) buffer_clear(&edt->command_buffer);
+        return;
     }
 
     while (codepoint > 0)
     {
         int len = 0;
         const char *char_encoded = CodepointToUTF8(codepoint, &len);
-        if (codepoint >= 32 && codepoint <= CODEPOINT_LEN)
+        if (codepoint >= 32) buffer_insert_bytes(&edt->command_buffer, char_encoded, len);
+        codepoint = input_char(&edt->input);
+    }
+}
+
+void editor_handle_input(Editor *edt)
+{
+    Buffer *buf = edt->buffers[edt->active_buffer];
+    Mode mode = edt->mode;
+
+    if (edt->mode == MODE_NORMAL)
+    {
+        handle_normal_mode(edt);
+    }
+    else if (edt->mode == MODE_INSERT)
+    {
+        handle_insert_mode(edt);
+    }
+    else if (edt->mode == MODE_COMMAND)
+    {
+        handle_command_mode(edt);
+    }
+    else if (edt->mode == MODE_SEARCH)
+    {
+        handle_search_mode(edt);
+    }
+
+    // Everything typed in one go in insert mode is undone together
+    if (edt->mode == MODE_INSERT && mode != MODE_INSERT && !buf->history.group) history_begin_group(&buf->history);
+    if (edt->mode != MODE_INSERT && mode == MODE_INSERT) history_end_group(&buf->history);
+}
+
+double replay_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Waits for the loads and the search to finish, so every frame of a replay
+// sees the same state no matter how fast the threads were
+void editor_replay_settle(Editor *edt)
+{
+    for (;;)
+    {
+        editor_poll_loading(edt);
+        editor_poll_search(edt);
+
+        int loading = 0;
+        for (size_t i = 0; i < edt->buffers_len; i++) loading |= edt->buffers[i]->loader != NULL;
+
+        if (!loading && !edt->search.started) return;
+        usleep(50);
+    }
+}
+
+// Feeds a recording through the handlers as fast as they take it and reports
+// how long each frame with a key or a character in it took
+int editor_replay(Editor *edt, const char *path)
+{
+    Input *in = &edt->input;
+
+    in->replay = fopen(path, "r");
+    if (in->replay == NULL)
+    {
+        fprintf(stderr, "[ERROR] Failed to open recording '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // The files come first, the frames stop at the first line that isn't one
+    char line[PATH_MAX + 8];
+    long pos = ftell(in->replay);
+
+    while (fgets(line, sizeof(line), in->replay) != NULL && strncmp(line, "file ", 5) == 0)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        editor_add_file(edt, strdup(line + 5));
+        pos = ftell(in->replay);
+    }
+
+    fseek(in->replay, pos, SEEK_SET);
+
+    if (edt->buffers_len > 0) editor_activate_buffer(edt, 0);
+    else editor_new_buffer(edt);
+
+    editor_replay_settle(edt);
+
+    size_t latencies_len = 0, latencies_cap = 1024;
+    double *latencies = malloc(latencies_cap * sizeof(*latencies));
+    assert(latencies != NULL && "Failed to alloc replay latencies");
+
+    size_t frames = 0, events = 0;
+    double start = replay_now();
+
+    while (input_read_frame(in))
+    {
+        double frame_start = replay_now();
+        editor_handle_input(edt);
+        double latency = replay_now() - frame_start;
+
+        frames += 1;
+        events += in->events;
+
+        if (in->events > 0)
         {
-            for (int i = 0; i < len; i++) buffer_insert(&edt->command_buffer, char_encoded[i]);
+            if (latencies_len == latencies_cap)
+            {
+                latencies_cap *= 2;
+                latencies = realloc(latencies, latencies_cap * sizeof(*latencies));
+                assert(latencies != NULL && "Failed to realloc replay latencies");
+            }
+
+            latencies[latencies_len++] = latency;
         }
-        codepoint = GetCharPressed();
+
+        editor_replay_settle(edt);
+    }
+
+    double total = replay_now() - start;
+    fclose(in->replay);
+
+    printf("Replayed %zu frames, %zu events in %.3f ms\n", frames, events, total * 1000);
+
+    if (latencies_len > 0)
+    {
+        qsort(latencies, latencies_len, sizeof(*latencies), profile_compare);
+
+        printf(
+            "Per frame with input: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+            latencies[(latencies_len - 1) * 50 / 100] * 1e6,
+            latencies[(latencies_len - 1) * 90 / 100] * 1e6,
+            latencies[(latencies_len - 1) * 99 / 100] * 1e6,
+            latencies[latencies_len - 1] * 1e6
+        );
     }
+
+    free(latencies);
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
+    Editor editor = {0};
+    editor_init(&editor);
+
+    const char *replay = NULL;
+    int low_latency = 0;
+
+    // Files are read when first switched to
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            if (profiler_open_trace(&editor.profiler, argv[++i]) < 0)
+                fprintf(stderr, "[ERROR] Failed to open trace '%s': %s\n", argv[i], strerror(errno));
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            editor.input.record = fopen(argv[++i], "w");
+            if (editor.input.record == NULL)
+                fprintf(stderr, "[ERROR] Failed to open recording '%s': %s\n", argv[i], strerror(errno));
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replay = argv[++i];
+        }
+        else if (strcmp(argv[i], "--low-latency") == 0)
+        {
+            low_latency = 1;
+        }
+        else if (strcmp(argv[i], "--wrap") == 0)
+        {
+            editor.wrap = 1;
+        }
+        else if (strcmp(argv[i], "--history-cap") == 0 && i + 1 < argc)
+        {
+            // In MB, 0 keeps no history
+            editor.history_cap = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else
+        {
+            editor_add_file(&editor, argv[i]);
+        }
+    }
+
+    for (size_t i = 0; i < editor.buffers_len; i++) editor.buffers[i]->history.cap = editor.history_cap;
+
+    // No window, the files are the ones in the recording
+    if (replay != NULL)
+    {
+        int ret = editor_replay(&editor, replay);
+        search_stop(&editor.search, 1);
+        return ret < 0;
+    }
+
+    if (editor.input.record != NULL)
+    {
+        for (size_t i = 0; i < editor.buffers_len; i++)
+            fprintf(editor.input.record, "file %s\n", editor.buffers[i]->filepath);
+    }
+
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     InitWindow(800, 600, "Codigo");
     SetTargetFPS(75);
@@ -771,32 +3351,70 @@ int main(int argc, char **argv)
     EnableEventWaiting();
     SetExitKey(0);
 
-    Editor editor = {0};
-    editor_init(&editor);
+    // The loop waits for input at the top instead of in EndDrawing, so a key
+    // is handled the moment it wakes the loop and presented right after, with
+    // no sleep to the target FPS in between. Frames only keep coming on their
+    // own while there is something to report back or a key repeats.
+    if (low_latency)
+    {
+        SetTargetFPS(0);
+        DisableEventWaiting();
+    }
+
+    double frame_interval = 1.0 / 75;
+    double next_frame = 0;
+    int busy = 0;
+
+    editor_load_font(&editor);
 
-    // TODO: Do some arguments parsing
-    if (argc > 1) editor_load_file(&editor, argv[1]);
+    if (editor.buffers_len > 0) editor_activate_buffer(&editor, 0);
     else editor_new_buffer(&editor);
 
     // editor_load_file(&editor, "Makefile");
     // editor_load_file(&editor, "resources/UTF-8-demo.txt");
 
+    size_t frames = 0;
+
     while (!WindowShouldClose())
     {
-        if (editor.mode == MODE_NORMAL)
-        {
-            handle_normal_mode(&editor);
-        }
-        else if (editor.mode == MODE_INSERT)
-        {
-            handle_insert_mode(&editor);
-        }
-        else if (editor.mode == MODE_COMMAND)
+        profiler_begin_frame(&editor.profiler);
+
+        double now = GetTime();
+        double wait = INPUT_NO_WAIT;
+        if (low_latency && !busy) wait = INPUT_WAIT_FOREVER;
+        else if (low_latency && next_frame > now) wait = next_frame - now;
+
+        input_poll(&editor.input, wait);
+        next_frame = editor.input.time + frame_interval;
+        editor_poll_loading(&editor);
+        editor_poll_save(&editor, 0);
+        editor_poll_search(&editor);
+
+        profiler_mark(&editor.profiler, PROFILE_POLL);
+
+        if (input_pressed(&editor.input, KEY_F2)) editor.profiler.visible = !editor.profiler.visible;
+
+        editor_handle_input(&editor);
+
+        profiler_mark(&editor.profiler, PROFILE_INPUT);
+
+        Buffer *buf = editor.buffers[editor.active_buffer];
+        int wrapping = editor_update_wrap(&editor, buf);
+
+        // Keep frames coming while there is something to report back
+        busy =
+            atomic_load(&editor.save.state) != SAVE_IDLE || atomic_load(&editor.search.running) ||
+            editor_status_visible(&editor) || editor.input.repeating || wrapping;
+
+        if (!low_latency)
         {
-            handle_command_mode(&editor);
+            if (busy) DisableEventWaiting();
+            else EnableEventWaiting();
         }
 
-        if (editor.mode == MODE_COMMAND)
+        int prompt = editor.mode == MODE_COMMAND || editor.mode == MODE_SEARCH;
+
+        if (prompt)
         {
             float width_factor = 1.5;
             int padding = editor.command_padding;
@@ -806,25 +3424,47 @@ int main(int argc, char **argv)
             editor.command_bounds.y      = GetScreenHeight() / 5 - padding;
         }
 
-        Buffer *buf = &editor.buffers[editor.active_buffer];
+        buf->last_viewed = GetTime();
+        editor_evict_buffers(&editor);
 
         buffer_update_scroll(buf, editor.font_size);
         editor_update_cursor(&editor);
 
-        BeginDrawing();
+        profiler_mark(&editor.profiler, PROFILE_LAYOUT);
+
+        // Rows of the text, the ones on screen are visual rows
+        size_t sub = 0;
+        size_t first_visual = (size_t)(buf->scroll.y / editor.font_size.y);
+        size_t last_visual = (size_t)((buf->scroll.y + GetScreenHeight()) / editor.font_size.y);
+        size_t first_row = wrap_layout_find(&buf->wrap, first_visual, &sub);
+        size_t last_row = wrap_layout_find(&buf->wrap, last_visual, &sub) + 1;
+        editor_update_visible_matches(
+            &editor, piece_table_row_start(&buf->text, first_row), piece_table_row_start(&buf->text, last_row)
+        );
+
+        // Text and cursor, repainted only where they changed
+        Rectangle text_cursor = editor.cursor;
+        if (prompt) text_cursor.width = 0;
+
+        // Colors of the rows on screen, before the layer works out what to
+        // repaint
+        highlighter_advance(&buf->syntax, last_row + 1);
 
-        ClearBackground(GetColor(COLOR_BG));
+        text_layer_update(
+            &editor.text_layer, &editor.font, &buf->text, &buf->syntax, &buf->wrap, editor.font_size, buf->scroll, text_cursor,
+            editor.visible_matches, editor.visible_matches_len, editor.visible_matches_version
+        );
 
-        // Cursor
-        if (editor.mode != MODE_COMMAND) DrawRectangleRec(editor.cursor, GetColor(COLOR_CURSOR));
+        BeginDrawing();
 
-        // Text
-        draw_characters(
-            editor.font, buf->text.data, (Vector2){0},
-            editor.font_size, buf->scroll, (Vector2){ editor.cursor.x, editor.cursor.y }
+        text_layer_draw(&editor.text_layer);
+        editor_draw_cursors(
+            &editor, piece_table_row_start(&buf->text, first_row), piece_table_row_start(&buf->text, last_row)
         );
 
-        if (editor.mode == MODE_COMMAND)
+        editor_draw_status(&editor);
+
+        if (prompt)
         {
             float thicc = 2.0;
             Rectangle border_rect = {0};
@@ -847,7 +3487,7 @@ int main(int argc, char **argv)
                 editor.command_bounds.x + editor.command_padding,
                 editor.command_bounds.y + editor.command_padding
             };
-            DrawTextCodepoint(editor.font, ':', prompt_pos, FONT_SIZE, GetColor(COLOR_FG));
+            glyph_cache_draw(&editor.font, editor.mode == MODE_SEARCH ? '/' : ':', prompt_pos, GetColor(COLOR_FG));
 
             // Text
             Vector2 text_origin = {
@@ -856,16 +3496,68 @@ int main(int argc, char **argv)
             };
 
             draw_characters(
-                editor.font,
-                editor.command_buffer.text.data,
+                &editor.command_lines,
+                &editor.font,
+                &editor.command_buffer.text,
+                NULL,
+                &editor.command_buffer.wrap,
                 text_origin,
                 editor.font_size,
                 (Vector2){-0,-0},
-                (Vector2){ editor.cursor.x, editor.cursor.y }
+                (Vector2){ editor.cursor.x, editor.cursor.y },
+                (Rectangle){0, 0, GetScreenWidth(), GetScreenHeight()}
             );
         }
 
+        profiler_draw(&editor.profiler, &editor.font, editor.font_size);
+        profiler_mark(&editor.profiler, PROFILE_RENDER);
+
+        // Sent here so EndDrawing only has the swap and the wait left
+        rlDrawRenderBatchActive();
+        profiler_mark(&editor.profiler, PROFILE_FLUSH);
+
         EndDrawing();
+        profiler_mark(&editor.profiler, PROFILE_END_DRAWING);
+
+        // Otherwise EndDrawing also waits for the next input, and the time
+        // would include that
+        if (low_latency && editor.input.events > 0)
+            profiler_add_latency(&editor.profiler, GetTime() - editor.input.arrived);
+
+        RenderStats render = editor.text_layer.lines.stats;
+        render.seconds += editor.command_lines.stats.seconds;
+        render.quads += editor.command_lines.stats.quads;
+        profiler_end_frame(&editor.profiler, render, buf->text.len);
+
+        frames += 1;
+    }
+
+    if (editor.profiler.trace != NULL) fclose(editor.profiler.trace);
+    if (editor.input.record != NULL) fclose(editor.input.record);
+
+    // Don't leave a save behind halfway
+    editor_poll_save(&editor, 1);
+    search_stop(&editor.search, 1);
+
+    // Per frame cost of the text layer, to compare changes to the renderer
+    RenderStats stats = editor.text_layer.lines.stats;
+    rlDrawStats draw_stats = rlGetDrawStats();
+
+    profiler_print_latency(&editor.profiler);
+
+    if (frames > 0)
+    {
+        printf(
+            "Rendered %zu frames, per frame: %.2f areas repainted, %.1f lines drawn, %.1f lines built, "
+            "%.1f quads, %.1f draw calls, %.1f vertices\n",
+            frames,
+            (double)editor.text_layer.repaints / frames,
+            (double)stats.lines_drawn / frames,
+            (double)stats.lines_built / frames,
+            (double)stats.quads / frames,
+            (double)draw_stats.drawCallCount / frames,
+            (double)draw_stats.vertexCount / frames
+        );
     }
 
     return 0;
@@ -0,0 +1,365 @@
+// Search patterns: plain strings are matched with the vector substring kernel
+// from scan.h, anything with a special character is compiled into a small
+// regex that runs in time linear in the text.
+//
+// The regex syntax is the usual subset: `.`, `[abc]`, `[^a-z]`, `*`, `+`,
+// `?`, `^`, `$` and `\` to escape. It works on bytes and never matches a
+// newline, so every match lies inside one line.
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include "scan.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define PATTERN_CAP 256
+
+typedef enum {
+    PATTERN_NODE_BYTES = 0, // Matches any byte in `set`
+    PATTERN_NODE_BOL,
+    PATTERN_NODE_EOL,
+} PatternNodeKind;
+
+typedef enum {
+    PATTERN_ONE = 0,
+    PATTERN_STAR,
+    PATTERN_PLUS,
+    PATTERN_QUEST,
+} PatternRepeat;
+
+// Whether the ends of the text given to pattern_find are ends of its line,
+// `^` and `$` can only match there if they are
+typedef enum {
+    PATTERN_LINE_START = 1,
+    PATTERN_LINE_END = 2,
+} PatternBounds;
+
+typedef struct {
+    PatternNodeKind kind;
+    PatternRepeat repeat;
+    unsigned char set[32];
+} PatternNode;
+
+typedef struct {
+    int is_regex;
+
+    // Literal patterns
+    char literal[PATTERN_CAP];
+    size_t literal_len;
+
+    // Regex patterns
+    PatternNode nodes[PATTERN_CAP];
+    size_t nodes_len;
+} Pattern;
+
+void pattern_set_add(unsigned char *set, unsigned char c)
+{
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+int pattern_set_has(const unsigned char *set, unsigned char c)
+{
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+// Parses `[...]` starting after the bracket, returns the position after the
+// closing one or 0 when there is none
+size_t pattern_parse_class(PatternNode *node, const char *src, size_t len, size_t i)
+{
+    int negate = 0;
+    if (i < len && src[i] == '^')
+    {
+        negate = 1;
+        i++;
+    }
+
+    size_t first = i;
+
+    // A `]` right after the opening bracket is taken literally
+    while (i < len && (src[i] != ']' || i == first))
+    {
+        unsigned char lo = src[i];
+        if (lo == '\\' && i + 1 < len) lo = src[++i];
+
+        if (i + 2 < len && src[i+1] == '-' && src[i+2] != ']')
+        {
+            unsigned char hi = src[i+2];
+            for (unsigned c = lo; c <= hi; c++) pattern_set_add(node->set, c);
+            i += 3;
+        }
+        else
+        {
+            pattern_set_add(node->set, lo);
+            i++;
+        }
+    }
+
+    if (i >= len) return 0;
+
+    if (negate)
+        for (int k = 0; k < 32; k++) node->set[k] = ~node->set[k];
+
+    return i + 1;
+}
+
+// Returns -1 when the pattern is malformed or too long
+int pattern_compile(Pattern *p, const char *src, size_t len)
+{
+    *p = (Pattern){0};
+
+    if (len == 0 || len >= PATTERN_CAP) return -1;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (strchr(".[]*+?^$\\", src[i]) != NULL) p->is_regex = 1;
+    }
+
+    if (!p->is_regex)
+    {
+        memcpy(p->literal, src, len);
+        p->literal_len = len;
+        return 0;
+    }
+
+    for (size_t i = 0; i < len;)
+    {
+        char c = src[i];
+
+        if (c == '*' || c == '+' || c == '?')
+        {
+            if (p->nodes_len == 0) return -1;
+
+            PatternNode *prev = &p->nodes[p->nodes_len - 1];
+            if (prev->kind != PATTERN_NODE_BYTES || prev->repeat != PATTERN_ONE) return -1;
+
+            prev->repeat = c == '*' ? PATTERN_STAR : c == '+' ? PATTERN_PLUS : PATTERN_QUEST;
+            i++;
+            continue;
+        }
+
+        PatternNode *node = &p->nodes[p->nodes_len++];
+
+        if (c == '^' && i == 0)
+        {
+            node->kind = PATTERN_NODE_BOL;
+            i++;
+        }
+        else if (c == '$' && i == len - 1)
+        {
+            node->kind = PATTERN_NODE_EOL;
+            i++;
+        }
+        else if (c == '.')
+        {
+            memset(node->set, 0xFF, sizeof(node->set));
+            i++;
+        }
+        else if (c == '[')
+        {
+            i = pattern_parse_class(node, src, len, i + 1);
+            if (i == 0) return -1;
+        }
+        else
+        {
+            if (c == '\\')
+            {
+                if (i + 1 >= len) return -1;
+                c = src[++i];
+            }
+
+            pattern_set_add(node->set, (unsigned char)c);
+            i++;
+        }
+
+        // Matches never cross lines
+        node->set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    }
+
+    return 0;
+}
+
+// Regex patterns run as a Pike VM: every thread is a node index and where its
+// match started, kept in a list in the order a backtracker would try them, so
+// the match found is the same one. Two threads at the same node at the same
+// byte have the same future and only the first is kept, which bounds the work
+// to the number of nodes for every byte.
+
+typedef struct {
+    size_t state; // 2k before node k, 2k+1 inside its repeat, 2n a match
+    size_t start;
+} PatternThread;
+
+typedef struct {
+    PatternThread threads[2 * PATTERN_CAP + 1];
+    size_t len;
+} PatternThreads;
+
+typedef struct {
+    const Pattern *p;
+    const char *data;
+    size_t len;
+    PatternBounds bounds;
+
+    size_t marks[2 * PATTERN_CAP + 1]; // List each state was last added to
+    size_t mark;
+
+    // Set when the thread being added can match without taking a byte, the
+    // backtracker would take that empty match and give up on the start
+    int empty;
+} PatternVm;
+
+// Adds `state` and whatever it reaches without taking a byte to `list`, in
+// the order a backtracker would try them
+void pattern_vm_add(PatternVm *vm, PatternThreads *list, size_t state, size_t start, size_t pos)
+{
+    if (vm->empty || vm->marks[state] == vm->mark) return;
+    vm->marks[state] = vm->mark;
+
+    const Pattern *p = vm->p;
+    size_t k = state / 2;
+
+    if (k == p->nodes_len)
+    {
+        if (pos == start) vm->empty = 1;
+        else list->threads[list->len++] = (PatternThread){state, start};
+        return;
+    }
+
+    const PatternNode *node = &p->nodes[k];
+
+    if (node->kind == PATTERN_NODE_BOL)
+    {
+        if (pos == 0 ? vm->bounds & PATTERN_LINE_START : vm->data[pos-1] == '\n') pattern_vm_add(vm, list, 2 * (k + 1), start, pos);
+        return;
+    }
+
+    if (node->kind == PATTERN_NODE_EOL)
+    {
+        if (pos == vm->len ? vm->bounds & PATTERN_LINE_END : vm->data[pos] == '\n') pattern_vm_add(vm, list, 2 * (k + 1), start, pos);
+        return;
+    }
+
+    // Taking a byte first, greedy
+    list->threads[list->len++] = (PatternThread){state, start};
+
+    int skip = node->repeat == PATTERN_STAR || node->repeat == PATTERN_QUEST;
+    if (node->repeat == PATTERN_PLUS && state % 2 == 1) skip = 1;
+
+    if (skip) pattern_vm_add(vm, list, 2 * (k + 1), start, pos);
+}
+
+// Finds the first non-empty match starting in data[from..len). `bounds` says
+// which ends of `data` are line ends for `^` and `$`, a text cut mid-line
+// leaves them out. Regex patterns give up and return 0 as soon as `cancel` is
+// set, when not NULL.
+int pattern_find(
+    const Pattern *p, const char *data, size_t len, size_t from, PatternBounds bounds,
+    size_t *start, size_t *match_len, atomic_int *cancel
+) {
+    if (!p->is_regex)
+    {
+        if (from >= len) return 0;
+
+        size_t found = scan_find(data + from, len - from, p->literal, p->literal_len);
+        if (found == len - from) return 0;
+
+        *start = from + found;
+        *match_len = p->literal_len;
+        return 1;
+    }
+
+    PatternVm vm;
+    PatternThreads lists[2];
+
+    vm.p = p;
+    vm.data = data;
+    vm.len = len;
+    vm.bounds = bounds;
+    memset(vm.marks, 0xFF, (2 * p->nodes_len + 1) * sizeof(*vm.marks));
+    vm.mark = 0;
+
+    PatternThreads *clist = &lists[0];
+    PatternThreads *nlist = &lists[1];
+    clist->len = 0;
+
+    const PatternNode *first = &p->nodes[0];
+    int anchored = first->kind == PATTERN_NODE_BOL;
+    int must_take = first->kind == PATTERN_NODE_BYTES && (first->repeat == PATTERN_ONE || first->repeat == PATTERN_PLUS);
+    int found = 0;
+    size_t steps = 0;
+
+    for (size_t pos = from; pos <= len; pos++)
+    {
+        if (++steps % 4096 == 0 && cancel != NULL && atomic_load(cancel)) return 0;
+
+        if (clist->len == 0)
+        {
+            if (found || pos >= len) break;
+
+            // Marks left from where the last threads died don't hold here
+            vm.mark += 1;
+
+            // Nothing running, jump to where a match could start
+            int line_start = pos == 0 ? bounds & PATTERN_LINE_START : data[pos-1] == '\n';
+
+            if (anchored && !line_start)
+            {
+                size_t nl = scan_next_newline(data + pos, len - pos);
+                if (nl == len - pos) break;
+                pos += nl + 1;
+            }
+            else if (must_take)
+            {
+                while (pos < len && !pattern_set_has(first->set, data[pos])) pos++;
+                if (pos == len) break;
+            }
+        }
+
+        // A new start goes last, the ones before it are further left
+        if (!found && pos < len)
+        {
+            vm.empty = 0;
+            pattern_vm_add(&vm, clist, 0, pos, pos);
+            vm.empty = 0;
+        }
+
+        vm.mark += 1;
+        nlist->len = 0;
+
+        for (size_t i = 0; i < clist->len; i++)
+        {
+            PatternThread t = clist->threads[i];
+            size_t k = t.state / 2;
+
+            if (k == p->nodes_len)
+            {
+                // Anything after this one would only have been tried if it
+                // had failed
+                *start = t.start;
+                *match_len = pos - t.start;
+                found = 1;
+                break;
+            }
+
+            const PatternNode *node = &p->nodes[k];
+            if (pos >= len || !pattern_set_has(node->set, data[pos])) continue;
+
+            size_t next = 2 * (k + 1);
+            if (node->repeat == PATTERN_STAR) next = 2 * k;
+            if (node->repeat == PATTERN_PLUS) next = 2 * k + 1;
+
+            pattern_vm_add(&vm, nlist, next, t.start, pos + 1);
+        }
+
+        PatternThreads *tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+    }
+
+    return found;
+}
+
+#endif // PATTERN_H
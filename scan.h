@@ -0,0 +1,495 @@
+// Text scanning kernels: newline counting and searching, substring search,
+// and codepoint counting over byte ranges. Each kernel has a scalar version and, on x86-64,
+// SSE2 and AVX2 versions; the best one the CPU supports is picked on first
+// use.
+//
+// Codepoints are counted as the bytes that are not UTF-8 continuation bytes
+// (10xxxxxx), the same rule the rest of the editor uses.
+//
+// The UTF-8 decoder follows that rule too, so what it draws always lines up
+// with the column math: every byte that isn't a continuation byte is one
+// cell, and a cell whose bytes are not one valid sequence decodes to U+FFFD.
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    const char *name;
+    size_t (*count_newlines)(const char *data, size_t len);
+    size_t (*count_codepoints)(const char *data, size_t len);
+    size_t (*next_newline)(const char *data, size_t len); // len when there is none
+    size_t (*prev_newline)(const char *data, size_t len); // SIZE_MAX when there is none
+
+    // Widens the leading ASCII bytes into `out`, which has room for `len`
+    // codepoints, and returns how many there were
+    size_t (*ascii_prefix)(const char *data, size_t len, int *out);
+
+    // First occurrence of `needle`, len when there is none
+    size_t (*find)(const char *data, size_t len, const char *needle, size_t needle_len);
+} ScanImpl;
+
+size_t scan_scalar_count_newlines(const char *data, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) count += data[i] == '\n';
+    return count;
+}
+
+size_t scan_scalar_count_codepoints(const char *data, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) count += (data[i] & 0xC0) != 0x80;
+    return count;
+}
+
+size_t scan_scalar_next_newline(const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        if (data[i] == '\n') return i;
+
+    return len;
+}
+
+size_t scan_scalar_prev_newline(const char *data, size_t len)
+{
+    for (size_t i = len; i > 0; i--)
+        if (data[i-1] == '\n') return i-1;
+
+    return SIZE_MAX;
+}
+
+size_t scan_scalar_ascii_prefix(const char *data, size_t len, int *out)
+{
+    size_t i = 0;
+    for (; i < len && (unsigned char)data[i] < 0x80; i++) out[i] = data[i];
+    return i;
+}
+
+size_t scan_scalar_find(const char *data, size_t len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0) return 0;
+
+    for (size_t i = 0; i + needle_len <= len;)
+    {
+        const char *first = memchr(data + i, needle[0], len - needle_len + 1 - i);
+        if (first == NULL) break;
+
+        i = first - data;
+        if (memcmp(data + i, needle, needle_len) == 0) return i;
+        i++;
+    }
+
+    return len;
+}
+
+const ScanImpl scan_scalar = {
+    "scalar",
+    scan_scalar_count_newlines,
+    scan_scalar_count_codepoints,
+    scan_scalar_next_newline,
+    scan_scalar_prev_newline,
+    scan_scalar_ascii_prefix,
+    scan_scalar_find,
+};
+
+#ifdef SCAN_X86
+
+// Counting kernels add the 0/-1 compare results into per-lane byte counters,
+// folded into the total with a sum of absolute differences before they can
+// overflow. Continuation bytes are the signed bytes below -64, every other
+// byte starts a codepoint.
+
+#define SCAN_SSE2_COUNT(data, len, match)                                       \
+    size_t count = 0;                                                           \
+    size_t i = 0;                                                               \
+    while (i + 16 <= len)                                                       \
+    {                                                                           \
+        __m128i acc = _mm_setzero_si128();                                      \
+        size_t end = len - i > 16*255 ? i + 16*255 : len;                       \
+        for (; i + 16 <= end; i += 16)                                          \
+        {                                                                       \
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));            \
+            acc = _mm_sub_epi8(acc, match);                                     \
+        }                                                                       \
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());                  \
+        count += _mm_cvtsi128_si64(sums) + _mm_extract_epi16(sums, 4);          \
+    }
+
+size_t scan_sse2_count_newlines(const char *data, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    SCAN_SSE2_COUNT(data, len, _mm_cmpeq_epi8(v, nl));
+    return count + scan_scalar_count_newlines(data + i, len - i);
+}
+
+size_t scan_sse2_count_codepoints(const char *data, size_t len)
+{
+    const __m128i limit = _mm_set1_epi8(-65);
+    SCAN_SSE2_COUNT(data, len, _mm_cmpgt_epi8(v, limit));
+    return count + scan_scalar_count_codepoints(data + i, len - i);
+}
+
+size_t scan_sse2_next_newline(const char *data, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_scalar_next_newline(data + i, len - i);
+}
+
+size_t scan_sse2_prev_newline(const char *data, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = len;
+
+    for (; i >= 16; i -= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i - 16));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0) return i - 16 + (31 - __builtin_clz(mask));
+    }
+
+    return scan_scalar_prev_newline(data, i);
+}
+
+// A whole block is widened even when it isn't all ASCII, the codepoints past
+// the run are overwritten by the caller
+size_t scan_sse2_ascii_prefix(const char *data, size_t len, int *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        _mm_storeu_si128((__m128i*)(out + i),      _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 4),  _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 8),  _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+
+        unsigned mask = _mm_movemask_epi8(v);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_scalar_ascii_prefix(data + i, len - i, out + i);
+}
+
+// Candidates are the positions where both the first and the last byte of the
+// needle match, only those get compared in full. The rest of the text is
+// rejected a block at a time.
+size_t scan_sse2_find(const char *data, size_t len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0) return 0;
+    if (needle_len > len) return len;
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    for (; i + needle_len - 1 + 16 <= len; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i block_last  = _mm_loadu_si128((const __m128i*)(data + i + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at, needle, needle_len) == 0) return at;
+        }
+    }
+
+    return i + scan_scalar_find(data + i, len - i, needle, needle_len);
+}
+
+#define SCAN_AVX2_COUNT(data, len, match)                                       \
+    size_t count = 0;                                                           \
+    size_t i = 0;                                                               \
+    while (i + 32 <= len)                                                       \
+    {                                                                           \
+        __m256i acc = _mm256_setzero_si256();                                   \
+        size_t end = len - i > 32*255 ? i + 32*255 : len;                       \
+        for (; i + 32 <= end; i += 32)                                          \
+        {                                                                       \
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));         \
+            acc = _mm256_sub_epi8(acc, match);                                  \
+        }                                                                       \
+        __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());            \
+        count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)  \
+               + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3); \
+    }
+
+__attribute__((target("avx2")))
+size_t scan_avx2_count_newlines(const char *data, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    SCAN_AVX2_COUNT(data, len, _mm256_cmpeq_epi8(v, nl));
+    return count + scan_sse2_count_newlines(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t scan_avx2_count_codepoints(const char *data, size_t len)
+{
+    const __m256i limit = _mm256_set1_epi8(-65);
+    SCAN_AVX2_COUNT(data, len, _mm256_cmpgt_epi8(v, limit));
+    return count + scan_sse2_count_codepoints(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t scan_avx2_next_newline(const char *data, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    return i + scan_sse2_next_newline(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t scan_avx2_prev_newline(const char *data, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = len;
+
+    for (; i >= 32; i -= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i - 32));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask != 0) return i - 32 + (31 - __builtin_clz(mask));
+    }
+
+    return scan_sse2_prev_newline(data, i);
+}
+
+__attribute__((target("avx2")))
+size_t scan_avx2_ascii_prefix(const char *data, size_t len, int *out)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m128i lo = _mm256_castsi256_si128(v);
+        __m128i hi = _mm256_extracti128_si256(v, 1);
+
+        _mm256_storeu_si256((__m256i*)(out + i),      _mm256_cvtepu8_epi32(lo));
+        _mm256_storeu_si256((__m256i*)(out + i + 8),  _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+        _mm256_storeu_si256((__m256i*)(out + i + 16), _mm256_cvtepu8_epi32(hi));
+        _mm256_storeu_si256((__m256i*)(out + i + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+
+        unsigned mask = _mm256_movemask_epi8(v);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+
+    // Runs are short in practice, so the tail stays in this function instead
+    // of paying for a call into the SSE2 kernel
+    if (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+
+        _mm256_storeu_si256((__m256i*)(out + i),     _mm256_cvtepu8_epi32(v));
+        _mm256_storeu_si256((__m256i*)(out + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+
+        unsigned mask = _mm_movemask_epi8(v);
+        if (mask != 0) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+
+    for (; i < len && (unsigned char)data[i] < 0x80; i++) out[i] = data[i];
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t scan_avx2_find(const char *data, size_t len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0) return 0;
+    if (needle_len > len) return len;
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last  = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    for (; i + needle_len - 1 + 32 <= len; i += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i block_last  = _mm256_loadu_si256((const __m256i*)(data + i + needle_len - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(data + at, needle, needle_len) == 0) return at;
+        }
+    }
+
+    return i + scan_scalar_find(data + i, len - i, needle, needle_len);
+}
+
+const ScanImpl scan_sse2 = {
+    "sse2",
+    scan_sse2_count_newlines,
+    scan_sse2_count_codepoints,
+    scan_sse2_next_newline,
+    scan_sse2_prev_newline,
+    scan_sse2_ascii_prefix,
+    scan_sse2_find,
+};
+
+const ScanImpl scan_avx2 = {
+    "avx2",
+    scan_avx2_count_newlines,
+    scan_avx2_count_codepoints,
+    scan_avx2_next_newline,
+    scan_avx2_prev_newline,
+    scan_avx2_ascii_prefix,
+    scan_avx2_find,
+};
+
+#endif // SCAN_X86
+
+const ScanImpl *scan_impl = NULL;
+
+// Best kernels for this CPU, picked once
+const ScanImpl *scan_get(void)
+{
+    if (scan_impl != NULL) return scan_impl;
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) scan_impl = &scan_avx2;
+    else scan_impl = &scan_sse2;
+#else
+    scan_impl = &scan_scalar;
+#endif
+
+    return scan_impl;
+}
+
+size_t scan_count_newlines(const char *data, size_t len)
+{
+    return scan_get()->count_newlines(data, len);
+}
+
+size_t scan_count_codepoints(const char *data, size_t len)
+{
+    return scan_get()->count_codepoints(data, len);
+}
+
+size_t scan_next_newline(const char *data, size_t len)
+{
+    return scan_get()->next_newline(data, len);
+}
+
+size_t scan_prev_newline(const char *data, size_t len)
+{
+    return scan_get()->prev_newline(data, len);
+}
+
+size_t scan_find(const char *data, size_t len, const char *needle, size_t needle_len)
+{
+    return scan_get()->find(data, len, needle, needle_len);
+}
+
+#define SCAN_REPLACEMENT 0xFFFD
+
+// Decodes the cell starting at the lead byte data[0], which spans every
+// continuation byte after it, and returns its length
+size_t scan_decode_cell(const char *data, size_t len, int *codepoint)
+{
+    const unsigned char *b = (const unsigned char*)data;
+
+    size_t cell_len = 1;
+    while (cell_len < len && (b[cell_len] & 0xC0) == 0x80) cell_len++;
+
+    // Expected length, first codepoint that needs it, and the range of the
+    // second byte that rules out overlong forms, surrogates and > U+10FFFF
+    size_t need = 0;
+    int min = 0;
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if      (b[0] >= 0xC2 && b[0] <= 0xDF) { need = 2; min = 0x80; }
+    else if (b[0] >= 0xE0 && b[0] <= 0xEF) { need = 3; min = 0x800; }
+    else if (b[0] >= 0xF0 && b[0] <= 0xF4) { need = 4; min = 0x10000; }
+
+    if (b[0] == 0xE0) lo = 0xA0;
+    if (b[0] == 0xED) hi = 0x9F;
+    if (b[0] == 0xF0) lo = 0x90;
+    if (b[0] == 0xF4) hi = 0x8F;
+
+    if (need == 0 || cell_len != need || b[1] < lo || b[1] > hi)
+    {
+        *codepoint = SCAN_REPLACEMENT;
+        return cell_len;
+    }
+
+    int cp = b[0] & (0x7F >> need);
+    for (size_t i = 1; i < need; i++) cp = (cp << 6) | (b[i] & 0x3F);
+
+    *codepoint = cp >= min ? cp : SCAN_REPLACEMENT;
+    return cell_len;
+}
+
+// Decodes up to `out_len` cells of `data` into `out`, returns how many. Runs
+// of ASCII go through the vector kernels, anything else one cell at a time.
+// Continuation bytes before the first lead byte belong to a cell that started
+// earlier and are skipped.
+size_t scan_decode_utf8(const char *data, size_t len, int *out, size_t out_len)
+{
+    const ScanImpl *impl = scan_get();
+
+    size_t i = 0;
+    size_t n = 0;
+
+    while (i < len && (data[i] & 0xC0) == 0x80) i++;
+
+    while (i < len && n < out_len)
+    {
+        size_t run = len - i < out_len - n ? len - i : out_len - n;
+        size_t ascii = impl->ascii_prefix(data + i, run, out + n);
+
+        i += ascii;
+        n += ascii;
+
+        // Continuation bytes right after an ASCII byte make that cell malformed
+        if (ascii > 0 && i < len && (data[i] & 0xC0) == 0x80)
+        {
+            out[n-1] = SCAN_REPLACEMENT;
+            while (i < len && (data[i] & 0xC0) == 0x80) i++;
+        }
+
+        if (i >= len || n >= out_len) break;
+        if ((unsigned char)data[i] < 0x80) continue;
+
+        i += scan_decode_cell(data + i, len - i, &out[n]);
+        n += 1;
+    }
+
+    return n;
+}
+
+#endif // SCAN_H
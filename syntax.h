@@ -0,0 +1,429 @@
+// Syntax highlighting lexers. A lexer colors one line at a time: it gets the
+// state the previous line ended in, writes the kind of every byte of the line
+// and returns the state the line ends in. The state is all that carries from
+// one line to the next, so the editor can keep it per line and only lex again
+// from an edited line until the state at the end of a line is what it was.
+//
+// Lines are passed without their newline.
+
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stddef.h>
+#include <string.h>
+
+typedef enum {
+    SYNTAX_TEXT = 0,
+    SYNTAX_KEYWORD,
+    SYNTAX_TYPE,
+    SYNTAX_STRING,
+    SYNTAX_NUMBER,
+    SYNTAX_COMMENT,
+    SYNTAX_PREPROC,
+    SYNTAX_VARIABLE,
+    SYNTAX_KIND_COUNT,
+} SyntaxKind;
+
+// What is still open at the end of a line, 0 is nothing
+typedef unsigned char SyntaxState;
+
+typedef SyntaxState (*SyntaxLexFn)(SyntaxState state, const char *line, size_t len, unsigned char *kinds);
+
+typedef struct {
+    const char *name;
+    const char *const *extensions; // Including the dot, NULL terminated
+    const char *const *filenames;  // Whole file names, NULL terminated
+    SyntaxLexFn lex;
+} Language;
+
+int syntax_is_ident(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+int syntax_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// The first letter is compared before anything else, most identifiers are
+// turned down right there
+int syntax_is_word(const char *const *words, const char *s, size_t len)
+{
+    for (; *words != NULL; words++)
+    {
+        const char *w = *words;
+        if (w[0] == s[0] && strlen(w) == len && memcmp(w, s, len) == 0) return 1;
+    }
+
+    return 0;
+}
+
+void syntax_mark(unsigned char *kinds, size_t from, size_t to, SyntaxKind kind)
+{
+    memset(kinds + from, kind, to - from);
+}
+
+// A line ending in a backslash carries on to the next one
+int syntax_continues(const char *line, size_t len)
+{
+    if (len > 0 && line[len-1] == '\r') len--;
+    return len > 0 && line[len-1] == '\\';
+}
+
+// Skips a quoted string starting at the quote in line[i], returns the
+// position after the closing quote or `len` when it isn't closed
+size_t syntax_skip_string(const char *line, size_t len, size_t i)
+{
+    char quote = line[i++];
+
+    while (i < len && line[i] != quote)
+        i += line[i] == '\\' ? 2 : 1;
+
+    return i < len ? i + 1 : len;
+}
+
+// C and C++
+
+enum {
+    SYNTAX_C_BLOCK_COMMENT = 1,
+    SYNTAX_C_LINE_COMMENT, // Continued with a backslash
+    SYNTAX_C_STRING,       // Continued with a backslash
+};
+
+const char *const syntax_c_keywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else", "enum", "extern", "for", "goto",
+    "if", "inline", "register", "restrict", "return", "sizeof", "static", "struct", "switch", "typedef",
+    "union", "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Generic", "_Noreturn",
+    "_Static_assert", "_Thread_local", "alignas", "alignof", "static_assert", "thread_local",
+    "class", "namespace", "template", "typename", "public", "private", "protected", "virtual", "new",
+    "delete", "this", "using", "operator", "constexpr", "nullptr", "true", "false", "NULL",
+    NULL,
+};
+
+const char *const syntax_c_types[] = {
+    "void", "char", "short", "int", "long", "float", "double", "signed", "unsigned", "bool", "_Bool",
+    "FILE", NULL,
+};
+
+const char *const syntax_c_extensions[] = {".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL};
+const char *const syntax_c_filenames[] = {NULL};
+
+SyntaxState syntax_lex_c(SyntaxState state, const char *line, size_t len, unsigned char *kinds)
+{
+    int continues = syntax_continues(line, len);
+    size_t i = 0;
+
+    // Whatever the previous line left open
+    if (state == SYNTAX_C_LINE_COMMENT)
+    {
+        syntax_mark(kinds, 0, len, SYNTAX_COMMENT);
+        return continues ? SYNTAX_C_LINE_COMMENT : 0;
+    }
+
+    if (state == SYNTAX_C_STRING)
+    {
+        while (i < len && line[i] != '"') i += line[i] == '\\' ? 2 : 1;
+        if (i > len) i = len;
+
+        if (i == len)
+        {
+            syntax_mark(kinds, 0, len, SYNTAX_STRING);
+            return continues ? SYNTAX_C_STRING : 0;
+        }
+
+        syntax_mark(kinds, 0, ++i, SYNTAX_STRING);
+    }
+
+    // Only spaces so far, a `#` here starts a directive
+    int line_start = 1;
+
+    while (i < len)
+    {
+        if (state == SYNTAX_C_BLOCK_COMMENT)
+        {
+            size_t start = i;
+            while (i + 1 < len && !(line[i] == '*' && line[i+1] == '/')) i++;
+
+            if (i + 1 >= len)
+            {
+                syntax_mark(kinds, start, len, SYNTAX_COMMENT);
+                return SYNTAX_C_BLOCK_COMMENT;
+            }
+
+            i += 2;
+            syntax_mark(kinds, start, i, SYNTAX_COMMENT);
+            state = 0;
+            continue;
+        }
+
+        char c = line[i];
+        char next = i + 1 < len ? line[i+1] : '\0';
+        size_t start = i;
+
+        if (c == '/' && next == '*')
+        {
+            state = SYNTAX_C_BLOCK_COMMENT;
+            i += 2;
+            syntax_mark(kinds, start, i, SYNTAX_COMMENT);
+            continue;
+        }
+
+        if (c == '/' && next == '/')
+        {
+            syntax_mark(kinds, start, len, SYNTAX_COMMENT);
+            return continues ? SYNTAX_C_LINE_COMMENT : 0;
+        }
+
+        if (c == '"' || c == '\'')
+        {
+            i = syntax_skip_string(line, len, i);
+            syntax_mark(kinds, start, i, SYNTAX_STRING);
+
+            // Unterminated, only a double quoted string carries on
+            if (i == len && c == '"' && continues) return SYNTAX_C_STRING;
+
+            line_start = 0;
+            continue;
+        }
+
+        if (c == '#' && line_start)
+        {
+            i++;
+            while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+
+            size_t word = i;
+            while (i < len && syntax_is_ident(line[i])) i++;
+            syntax_mark(kinds, start, i, SYNTAX_PREPROC);
+
+            // The header of an include reads like a string
+            if (i - word == 7 && memcmp(line + word, "include", 7) == 0)
+            {
+                size_t space = i;
+                while (i < len && line[i] == ' ') i++;
+                syntax_mark(kinds, space, i, SYNTAX_TEXT);
+
+                if (i < len && line[i] == '<')
+                {
+                    size_t header = i;
+                    while (i < len && line[i] != '>') i++;
+                    if (i < len) i++;
+                    syntax_mark(kinds, header, i, SYNTAX_STRING);
+                }
+            }
+
+            line_start = 0;
+            continue;
+        }
+
+        if (syntax_is_digit(c) || (c == '.' && syntax_is_digit(next)))
+        {
+            // Close enough for every literal that compiles: digits, suffixes,
+            // hex letters, separators and signed exponents
+            i++;
+            while (i < len)
+            {
+                char d = line[i];
+                char prev = line[i-1];
+
+                if (syntax_is_ident(d) || d == '.' || d == '\'') i++;
+                else if ((d == '+' || d == '-') && (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P')) i++;
+                else break;
+            }
+
+            syntax_mark(kinds, start, i, SYNTAX_NUMBER);
+            line_start = 0;
+            continue;
+        }
+
+        if (syntax_is_ident(c))
+        {
+            while (i < len && syntax_is_ident(line[i])) i++;
+
+            size_t n = i - start;
+            SyntaxKind kind = SYNTAX_TEXT;
+
+            if (syntax_is_word(syntax_c_keywords, line + start, n)) kind = SYNTAX_KEYWORD;
+            else if (syntax_is_word(syntax_c_types, line + start, n)) kind = SYNTAX_TYPE;
+            else if (n > 2 && line[i-2] == '_' && line[i-1] == 't') kind = SYNTAX_TYPE; // size_t, uint8_t...
+
+            syntax_mark(kinds, start, i, kind);
+            line_start = 0;
+            continue;
+        }
+
+        if (c != ' ' && c != '\t') line_start = 0;
+        kinds[i++] = SYNTAX_TEXT;
+    }
+
+    return state;
+}
+
+// Makefiles
+
+enum {
+    SYNTAX_MAKE_COMMENT = 1, // Continued with a backslash
+    SYNTAX_MAKE_DEFINE,      // Inside define ... endef
+};
+
+const char *const syntax_make_directives[] = {
+    "include", "-include", "sinclude", "ifeq", "ifneq", "ifdef", "ifndef", "else", "endif", "define",
+    "endef", "export", "unexport", "override", "vpath", "private", NULL,
+};
+
+const char *const syntax_make_extensions[] = {".mk", ".mak", NULL};
+const char *const syntax_make_filenames[] = {"Makefile", "makefile", "GNUmakefile", NULL};
+
+// Marks a variable reference starting at the `$` in line[i], returns the
+// position after it
+size_t syntax_make_variable(const char *line, size_t len, size_t i, unsigned char *kinds)
+{
+    size_t start = i++;
+
+    if (i < len && (line[i] == '(' || line[i] == '{'))
+    {
+        char open = line[i];
+        char close = open == '(' ? ')' : '}';
+        int depth = 0;
+
+        for (; i < len; i++)
+        {
+            if (line[i] == open) depth++;
+            if (line[i] == close && --depth == 0) break;
+        }
+
+        if (i < len) i++;
+    }
+    else if (i < len)
+    {
+        i++;
+    }
+
+    syntax_mark(kinds, start, i, SYNTAX_VARIABLE);
+    return i;
+}
+
+SyntaxState syntax_lex_make(SyntaxState state, const char *line, size_t len, unsigned char *kinds)
+{
+    int continues = syntax_continues(line, len);
+
+    syntax_mark(kinds, 0, len, SYNTAX_TEXT);
+
+    if (state == SYNTAX_MAKE_COMMENT)
+    {
+        syntax_mark(kinds, 0, len, SYNTAX_COMMENT);
+        return continues ? SYNTAX_MAKE_COMMENT : 0;
+    }
+
+    // First word of the line, directives and the end of a define are told
+    // apart by it
+    size_t word = 0;
+    while (word < len && (line[word] == ' ' || line[word] == '\t')) word++;
+
+    size_t word_end = word;
+    while (word_end < len && (syntax_is_ident(line[word_end]) || line[word_end] == '-')) word_end++;
+
+    if (state == SYNTAX_MAKE_DEFINE)
+    {
+        if (word_end - word == 5 && memcmp(line + word, "endef", 5) == 0)
+        {
+            syntax_mark(kinds, word, word_end, SYNTAX_KEYWORD);
+            return 0;
+        }
+
+        for (size_t i = 0; i < len;)
+        {
+            if (line[i] == '$') i = syntax_make_variable(line, len, i, kinds);
+            else i++;
+        }
+
+        return SYNTAX_MAKE_DEFINE;
+    }
+
+    int recipe = len > 0 && line[0] == '\t';
+    size_t i = 0;
+
+    if (!recipe && word_end > word && syntax_is_word(syntax_make_directives, line + word, word_end - word))
+    {
+        syntax_mark(kinds, word, word_end, SYNTAX_KEYWORD);
+        if (word_end - word == 6 && memcmp(line + word, "define", 6) == 0) state = SYNTAX_MAKE_DEFINE;
+        i = word_end;
+    }
+    else if (!recipe)
+    {
+        // `name = value` names a variable, `name: prerequisites` a target
+        size_t k = 0;
+        while (k < len && line[k] != '=' && line[k] != ':' && line[k] != '#' && line[k] != '$') k++;
+
+        if (k < len && (line[k] == '=' || line[k] == ':'))
+        {
+            int assign = line[k] == '=' || (k + 1 < len && line[k+1] == '=');
+
+            // Operators like `+=`, `?=` and `!=` are not part of the name
+            size_t name_end = k;
+            if (line[k] == '=' && k > 0 && strchr("+?!", line[k-1]) != NULL) name_end--;
+            while (name_end > word && (line[name_end-1] == ' ' || line[name_end-1] == '\t')) name_end--;
+
+            syntax_mark(kinds, word, name_end, assign ? SYNTAX_VARIABLE : SYNTAX_TYPE);
+            i = k;
+        }
+    }
+
+    while (i < len)
+    {
+        char c = line[i];
+
+        if (c == '#')
+        {
+            syntax_mark(kinds, i, len, SYNTAX_COMMENT);
+            return continues ? SYNTAX_MAKE_COMMENT : state;
+        }
+
+        if (c == '$')
+        {
+            i = syntax_make_variable(line, len, i, kinds);
+            continue;
+        }
+
+        if ((c == '"' || c == '\'') && recipe)
+        {
+            size_t start = i;
+            i = syntax_skip_string(line, len, i);
+            syntax_mark(kinds, start, i, SYNTAX_STRING);
+            continue;
+        }
+
+        i++;
+    }
+
+    return state;
+}
+
+const Language syntax_languages[] = {
+    {"c", syntax_c_extensions, syntax_c_filenames, syntax_lex_c},
+    {"make", syntax_make_extensions, syntax_make_filenames, syntax_lex_make},
+};
+
+// Picks the language from the file name, NULL for plain text
+const Language *syntax_detect(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+
+    const char *ext = strrchr(name, '.');
+
+    for (size_t i = 0; i < sizeof(syntax_languages) / sizeof(*syntax_languages); i++)
+    {
+        const Language *lang = &syntax_languages[i];
+
+        for (const char *const *f = lang->filenames; *f != NULL; f++)
+            if (strcmp(name, *f) == 0) return lang;
+
+        for (const char *const *e = lang->extensions; ext != NULL && *e != NULL; e++)
+            if (strcmp(ext, *e) == 0) return lang;
+    }
+
+    return NULL;
+}
+
+#endif // SYNTAX_H